@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/parser/parser.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/jit.h"
+
+#define RUNS 5
+
+static inline double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct mode {
+	char *name;
+	int (*run)(struct vm * restrict);
+	uint32_t jit_threshold;
+	uint32_t trace_threshold;
+};
+
+static struct mode modes[] = {
+	{"goto", vm_run, 0, 0},
+	{"threaded", vm_run_threaded, 0, 0},
+	{"jit", vm_run, JIT_THRESHOLD, 0},
+	{"trace", vm_run, 0, TRACE_THRESHOLD},
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+// Runs the program once and returns the elapsed time.
+static double run_once(char *input, struct mode m) {
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	vm->jit_threshold = m.jit_threshold;
+	vm->trace_threshold = m.trace_threshold;
+
+	double start = now();
+	m.run(vm);
+	double elapsed = now() - start;
+
+	vm_dispose(vm);
+	compiler_dispose(c);
+	tree->dispose(tree);
+	return elapsed;
+}
+
+// Objects are never freed, so each run is done in a child process to
+// start from the same clean heap.
+static double measure(char *input, struct mode m) {
+	int fds[2];
+	double elapsed = 0;
+
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		elapsed = run_once(input, m);
+		write(fds[1], &elapsed, sizeof(elapsed));
+		_exit(0);
+	}
+	close(fds[1]);
+	if (read(fds[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+		puts("benchmark run failed");
+		exit(1);
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return elapsed;
+}
+
+// The changes are relative to the first mode.
+static void bench(char *name, char *input) {
+	double best[NMODES];
+
+	for (int i = 0; i < RUNS; i++) {
+		for (size_t j = 0; j < NMODES; j++) {
+			double t = measure(input, modes[j]);
+			if (i == 0 || t < best[j]) best[j] = t;
+		}
+	}
+
+	printf("%-8s", name);
+	for (size_t j = 0; j < NMODES; j++) {
+		printf("  %s %.2f ms", modes[j].name, best[j] * 1e3);
+		if (j > 0) printf(" (%+.1f%%)", (best[j] - best[0]) / best[0] * 100);
+	}
+	putchar('\n');
+}
+
+int main() {
+	bench("fib", "fib = fn(n) { if n < 2 { n } else { fib(n - 1) + fib(n - 2) } }; fib(27)");
+	bench("loop", "loop = fn(n, acc) { if n > 0 { loop(n - 1, acc + n) } else { acc } }; loop(3000000, 0)");
+	bench("arith", "loop = fn(n, a, b) { if n > 0 { loop(n - 1, a + b - n, b + n - a) } else { a + b } }; loop(3000000, 0, 1)");
+	bench("closure",
+		"counter = fn() { n = 0; fn() { n = n + 1 } };"
+		"c = counter();"
+		"loop = fn(i) { if i > 0 { c(); loop(i - 1) } else { c() } }; loop(2000000)");
+	return 0;
+}
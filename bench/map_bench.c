@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../src/obj/obj.h"
+
+#define N 1000000
+
+static inline double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(char *name, double start) {
+	double elapsed = now() - start;
+	printf("%-20s %8.2f ms  %6.1f ns/op\n", name, elapsed * 1e3, elapsed * 1e9 / N);
+}
+
+int main() {
+	struct object **ikeys = malloc(sizeof(struct object *) * N);
+	struct object **skeys = malloc(sizeof(struct object *) * N);
+	char buf[32];
+
+	for (int i = 0; i < N; i++) {
+		ikeys[i] = new_integer_obj(i);
+		int len = snprintf(buf, sizeof(buf), "key%d", i);
+		skeys[i] = new_string_obj(buf, len);
+	}
+
+	struct object *m = new_map_obj(0);
+	double start = now();
+	for (int i = 0; i < N; i++) {
+		map_set(m->data.map, ikeys[i], ikeys[i]);
+	}
+	report("int insert", start);
+
+	start = now();
+	int64_t sum = 0;
+	for (int i = 0; i < N; i++) {
+		sum += map_get(m->data.map, ikeys[i])->data.i;
+	}
+	report("int lookup", start);
+
+	m = new_map_obj(0);
+	start = now();
+	for (int i = 0; i < N; i++) {
+		map_set(m->data.map, skeys[i], ikeys[i]);
+	}
+	report("string insert", start);
+
+	start = now();
+	for (int i = 0; i < N; i++) {
+		sum += map_get(m->data.map, skeys[i])->data.i;
+	}
+	report("string lookup", start);
+
+	m = new_map_obj(N);
+	start = now();
+	for (int i = 0; i < N; i++) {
+		map_set(m->data.map, skeys[i], ikeys[i]);
+	}
+	report("string insert sized", start);
+
+	return sum == 0;
+}
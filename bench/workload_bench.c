@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "../src/parser/parser.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+
+// Runs the Tau programs of bench/workloads, each in its own process a
+// number of times, and reports the wall time, the instructions retired,
+// the peak RSS and the allocations of the runs. The allocations are
+// counted by wrapping malloc, calloc and realloc at link time, see the
+// Makefile.
+//
+// Usage: workload_bench [-n runs] [-d dir] [-o results.json] [name...]
+
+#define DEFAULT_RUNS 10
+#define MAX_WORKLOADS 64
+
+struct result {
+	double ms;
+	int64_t instructions; // -1 if the counter isn't available
+	long max_rss_kb;
+	uint64_t allocs;
+};
+
+struct summary {
+	char name[64];
+	double median_ms;
+	double p99_ms;
+	int64_t instructions;
+	long max_rss_kb;
+	uint64_t allocs;
+};
+
+static int counting;
+static uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	allocs += counting;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	allocs += counting;
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	allocs += counting;
+	return __real_realloc(p, size);
+}
+
+static inline double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns the file descriptor of a counter of the user space
+// instructions of this process, or -1 if there's none.
+static int open_instructions_counter() {
+#ifdef __linux__
+	struct perf_event_attr attr = {0};
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static char *read_file(char *path, size_t *len) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	rewind(f);
+	char *buf = malloc(*len + 1);
+	if (fread(buf, 1, *len, f) != *len) {
+		perror(path);
+		exit(1);
+	}
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+// Compiles and runs the program, measuring only the run.
+static struct result run_once(char *path) {
+	size_t len;
+	char *input = read_file(path, &len);
+	struct node *tree = parse_input(input, len);
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	struct result r = {.instructions = -1};
+	int fd = open_instructions_counter();
+
+#ifdef __linux__
+	if (fd != -1) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+	counting = 1;
+	double start = now();
+	vm_run(vm);
+	r.ms = (now() - start) * 1e3;
+	counting = 0;
+#ifdef __linux__
+	if (fd != -1) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &r.instructions, sizeof(r.instructions)) != sizeof(r.instructions)) {
+			r.instructions = -1;
+		}
+		close(fd);
+	}
+#endif
+	out_flush();
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	r.max_rss_kb = ru.ru_maxrss;
+	r.allocs = allocs;
+	return r;
+}
+
+// Objects are never freed, so each run is done in a child process to
+// start from the same clean heap.
+static struct result measure(char *path) {
+	int fds[2];
+	struct result r;
+
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		exit(1);
+	}
+	// What's buffered would be printed by the child too.
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		// The programs' output isn't part of the report.
+		freopen("/dev/null", "w", stdout);
+		r = run_once(path);
+		write(fds[1], &r, sizeof(r));
+		_exit(0);
+	}
+	close(fds[1]);
+	if (read(fds[0], &r, sizeof(r)) != sizeof(r)) {
+		printf("%s: run failed\n", path);
+		exit(1);
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return r;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(double *) a, y = *(double *) b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_int64(const void *a, const void *b) {
+	int64_t x = *(int64_t *) a, y = *(int64_t *) b;
+	return (x > y) - (x < y);
+}
+
+static int cmp_str(const void *a, const void *b) {
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+// The percentiles are the nearest rank of the sorted runs.
+static struct summary summarize(char *name, struct result *runs, int n) {
+	double *ms = malloc(sizeof(double) * n);
+	int64_t *insts = malloc(sizeof(int64_t) * n);
+	uint64_t *counts = malloc(sizeof(uint64_t) * n);
+	struct summary s = {0};
+
+	snprintf(s.name, sizeof(s.name), "%s", name);
+	for (int i = 0; i < n; i++) {
+		ms[i] = runs[i].ms;
+		insts[i] = runs[i].instructions;
+		counts[i] = runs[i].allocs;
+		if (runs[i].max_rss_kb > s.max_rss_kb) s.max_rss_kb = runs[i].max_rss_kb;
+	}
+	qsort(ms, n, sizeof(double), cmp_double);
+	qsort(insts, n, sizeof(int64_t), cmp_int64);
+	qsort(counts, n, sizeof(uint64_t), cmp_int64);
+
+	s.median_ms = n % 2 ? ms[n/2] : (ms[n/2-1] + ms[n/2]) / 2;
+	s.p99_ms = ms[(99 * n + 99) / 100 - 1];
+	s.instructions = insts[n/2];
+	s.allocs = counts[n/2];
+
+	free(ms);
+	free(insts);
+	free(counts);
+	return s;
+}
+
+static void write_json(char *path, struct summary *s, int n, int runs) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	fprintf(f, "{\n\t\"runs\": %d,\n\t\"workloads\": [\n", runs);
+	for (int i = 0; i < n; i++) {
+		fprintf(f, "\t\t{\"name\": \"%s\", \"median_ms\": %.3f, \"p99_ms\": %.3f, ", s[i].name, s[i].median_ms, s[i].p99_ms);
+		if (s[i].instructions == -1) {
+			fprintf(f, "\"instructions\": null, ");
+		} else {
+			fprintf(f, "\"instructions\": %lld, ", (long long) s[i].instructions);
+		}
+		fprintf(f, "\"max_rss_kb\": %ld, \"allocations\": %llu}%s\n",
+			s[i].max_rss_kb, (unsigned long long) s[i].allocs, i + 1 < n ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+	fclose(f);
+}
+
+static int selected(char *name, char **names, int nnames) {
+	if (nnames == 0) {
+		return 1;
+	}
+	for (int i = 0; i < nnames; i++) {
+		if (strcmp(name, names[i]) == 0) return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char *dir = "bench/workloads";
+	char *json = NULL;
+	int runs = DEFAULT_RUNS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'o':
+			json = optarg;
+			break;
+		default:
+			puts("usage: workload_bench [-n runs] [-d dir] [-o results.json] [name...]");
+			return 1;
+		}
+	}
+	if (runs < 1) {
+		puts("the number of runs has to be positive");
+		return 1;
+	}
+
+	DIR *d = opendir(dir);
+	if (d == NULL) {
+		perror(dir);
+		return 1;
+	}
+	char *files[MAX_WORKLOADS];
+	int nfiles = 0;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL && nfiles < MAX_WORKLOADS) {
+		size_t len = strlen(e->d_name);
+		if (len > 4 && strcmp(&e->d_name[len-4], ".tau") == 0) {
+			files[nfiles++] = strdup(e->d_name);
+		}
+	}
+	closedir(d);
+	qsort(files, nfiles, sizeof(char *), cmp_str);
+
+	struct summary sums[MAX_WORKLOADS];
+	struct result *results = malloc(sizeof(struct result) * runs);
+	int nsums = 0;
+
+	printf("%-12s %10s %10s %14s %10s %10s\n", "workload", "median", "p99", "instructions", "peak rss", "allocs");
+	for (int i = 0; i < nfiles; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%.*s", (int) strlen(files[i]) - 4, files[i]);
+		if (!selected(name, &argv[optind], argc - optind)) {
+			continue;
+		}
+
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+		for (int j = 0; j < runs; j++) {
+			results[j] = measure(path);
+		}
+
+		struct summary s = summarize(name, results, runs);
+		sums[nsums++] = s;
+		printf("%-12s %7.2f ms %7.2f ms ", s.name, s.median_ms, s.p99_ms);
+		if (s.instructions == -1) {
+			printf("%14s ", "-");
+		} else {
+			printf("%14lld ", (long long) s.instructions);
+		}
+		printf("%6.1f MiB %10llu\n", s.max_rss_kb / 1024.0, (unsigned long long) s.allocs);
+	}
+
+	if (json != NULL) {
+		write_json(json, sums, nsums, runs);
+	}
+	free(results);
+	for (int i = 0; i < nfiles; i++) {
+		free(files[i]);
+	}
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -6,6 +7,7 @@
 #include "src/parser/parser.h"
 #include "src/compiler/compiler.h"
 #include "src/vm/vm.h"
+#include "src/vm/jit.h"
 
 #define BUF_SIZE 4096
 
@@ -34,7 +36,8 @@ static inline size_t accept_until(char buf[BUF_SIZE], char *end) {
 	buf[len++] = '\n';
 
 	for (;;) {
-		printf("... ");
+		out_write("... ", 4);
+		out_flush();
 		fgets(&buf[len], BUF_SIZE - len, stdin);
 		len += strlen(&buf[len]);
 
@@ -48,11 +51,32 @@ static inline size_t accept_until(char buf[BUF_SIZE], char *end) {
 
 int main() {
 	struct state state = new_state();
+	int threaded = getenv("TAU_THREADED") != NULL;
+	int optimize = getenv("TAU_OPT") != NULL;
+	// TAU_INLINE sets the size of the functions the optimizer inlines.
+	char *inline_threshold = getenv("TAU_INLINE");
+	int inline_report = getenv("TAU_INLINE_REPORT") != NULL;
+	// TAU_JIT enables the JIT, optionally with the call threshold.
+	char *jit = getenv("TAU_JIT");
+	uint32_t jit_threshold = 0;
+	if (jit != NULL) {
+		jit_threshold = atoi(jit) > 0 ? atoi(jit) : JIT_THRESHOLD;
+	}
+	// TAU_TRACE enables the tracing of loops the same way.
+	char *trace = getenv("TAU_TRACE");
+	uint32_t trace_threshold = 0;
+	if (trace != NULL) {
+		trace_threshold = atoi(trace) > 0 ? atoi(trace) : TRACE_THRESHOLD;
+	}
 
 	for (;;) {
 		char buf[BUF_SIZE] = {'\0'};
-		printf(">>> ");
-		fgets(buf, BUF_SIZE, stdin);
+		out_write(">>> ", 4);
+		out_flush();
+		if (fgets(buf, BUF_SIZE, stdin) == NULL) {
+			out_write("\n", 1);
+			return 0;
+		}
 		trim_right(buf, " \n\t\r");
 
 		size_t len = strlen(buf);
@@ -62,12 +86,37 @@ int main() {
 
 		struct node *tree = parse_input(buf, len);
 		struct compiler *c = new_compiler_with_state(state.st, &state.consts, state.nconsts);
+		c->optimize = optimize;
+		c->inline_report = inline_report;
+		if (inline_threshold != NULL) {
+			c->inline_threshold = atoi(inline_threshold);
+		}
 		compile(c, tree);
+		if (inline_report) {
+			fflush(stdout);
+		}
 		struct bytecode bc = compiler_bytecode(c);
-		state.nconsts += bc.nconsts;
+		state.nconsts = bc.nconsts;
+
+		struct vm *vm = new_vm_with_state(bc, &state);
+		vm->jit_threshold = jit_threshold;
+		vm->trace_threshold = trace_threshold;
+		if (threaded) {
+			vm_run_threaded(vm);
+		} else {
+			vm_run(vm);
+		}
 
-		struct vm *vm = new_vm_with_state(bc, state);
-		vm_run(vm);
+		if (getenv("TAU_IC_STATS") != NULL) {
+			out_flush();
+			vm_print_inline_caches(vm);
+			fflush(stdout);
+		}
+		if (getenv("TAU_TRACE_STATS") != NULL) {
+			out_flush();
+			vm_print_trace_stats(vm);
+			fflush(stdout);
+		}
 
 		struct object *o = vm_last_popped_stack_elem(vm);
 		o->print(o);
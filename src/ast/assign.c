@@ -10,17 +10,44 @@ int compile_assign(struct node *n, struct compiler *c) {
 
 	switch (a->l->type) {
 	case identifier_node_t: {
-		struct symbol *s = compiler_define(c, a->l->data);
+		// Assigning to a variable of an enclosing function updates the
+		// captured variable, otherwise a new one is defined.
+		struct symbol *s = compiler_resolve(c, a->l->data);
+		if (s == NULL || s->scope == builtin_scope) {
+			s = compiler_define(c, a->l->data);
+		}
+		int start = compiler_pos(c);
 		CHECK(a->r->compile(a->r, c));
 
-		enum opcode op = s->scope == global_scope ? op_set_global : op_set_local;
-		return compiler_emit(c, op, s->index);
+		switch (s->scope) {
+		case global_scope:
+			compiler_count_assign(c, s, start);
+			return compiler_emit(c, op_set_global, s->index);
+		case free_scope:
+			return compiler_emit(c, op_set_free, s->index);
+		case local_scope:
+			return compiler_emit(c, op_set_local, s->index);
+		default:
+			printf("cannot assign to %s\n", s->name);
+			return -1;
+		}
 	}
 
-	// case dot_node:
-	// case index_node:
-	// 	puts("assign: node not yet supported");
-	// 	return -1;
+	case index_node_t: {
+		struct index_node *i = a->l->data;
+		CHECK(i->left->compile(i->left, c));
+		CHECK(i->index->compile(i->index, c));
+		CHECK(a->r->compile(a->r, c));
+		return compiler_emit(c, op_define);
+	}
+
+	case dot_node_t: {
+		struct dot_node *d = a->l->data;
+		CHECK(d->left->compile(d->left, c));
+		CHECK(compiler_emit(c, op_constant, compiler_add_const(c, new_string_obj(d->field, d->len))));
+		CHECK(a->r->compile(a->r, c));
+		return compiler_emit(c, op_define);
+	}
 
 	default:
 		puts("cannot assign to literal");
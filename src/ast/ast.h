@@ -25,16 +25,29 @@ enum node_type {
 	return_node_t,
 	identifier_node_t,
 	ifelse_node_t,
-	assign_node_t
+	assign_node_t,
+	string_node_t,
+	map_node_t,
+	index_node_t,
+	dot_node_t,
+	interpolated_node_t,
+	list_node_t
 };
 
 struct node {
 	void *data;
 	enum node_type type;
+	// Set by the parent node when it consumes the value without storing
+	// it anywhere, so that the value can't outlive the frame evaluating it.
+	int noescape;
 	int (*compile)(struct node *n, struct compiler *c);
 	void (*dispose)(struct node *n);
 };
 
+static inline void mark_noescape(struct node *n) {
+	n->noescape = 1;
+}
+
 typedef int (*compilefn)(struct node *n, struct compiler *c);
 typedef void (*disposefn)(struct node *n);
 
@@ -43,6 +56,17 @@ struct block_node {
 	size_t len;
 };
 
+struct index_node {
+	struct node *left;
+	struct node *index;
+};
+
+struct dot_node {
+	struct node *left;
+	char *field;
+	size_t len;
+};
+
 struct node *new_node(void *data, enum node_type t, compilefn cfn, disposefn dfn);
 struct node *new_plus(struct node *l, struct node *r);
 struct node *new_minus(struct node *l, struct node *r);
@@ -59,6 +83,12 @@ struct node *new_assign(struct node *l, struct node *r);
 struct node *new_call(struct node *fn, struct node **args, size_t arglen);
 struct node *new_ifelse(struct node *cond, struct node *body, struct node *altern);
 struct node *new_function(char **params, size_t nparams, struct node *body);
+struct node *new_string(char *str, size_t len);
+struct node *new_map(struct node **keys, struct node **vals, size_t len);
+struct node *new_index(struct node *left, struct node *index);
+struct node *new_dot(struct node *left, char *field, size_t len);
+struct node *new_list(struct node **elems, size_t len);
+struct node *new_interpolated(char **parts, size_t *lens, struct node **exprs, size_t nexprs);
 
 void block_add_statement(struct block_node *b, struct node *s);
 
@@ -10,13 +10,28 @@ int compile_call(struct node *n, struct compiler *c) {
 	struct call_node *call = n->data;
 	int pos = 0;
 
-	CHECK(pos = call->fn->compile(call->fn, c));
+	struct symbol *builtin = NULL;
+
+	// Builtins are called directly by index without loading them first.
+	if (call->fn->type == identifier_node_t) {
+		struct symbol *s = compiler_resolve(c, call->fn->data);
+
+		if (s != NULL && s->scope == builtin_scope) {
+			builtin = s;
+		}
+	}
+	if (builtin == NULL) {
+		CHECK(pos = call->fn->compile(call->fn, c));
+	}
 
 	for (int i = 0; i < call->arglen; i++) {
 		struct node *arg = call->args[i];
 		CHECK(pos = arg->compile(arg, c));
 	}
 
+	if (builtin != NULL) {
+		return compiler_emit(c, op_call_builtin, builtin->index, call->arglen);
+	}
 	return compiler_emit(c, op_call, call->arglen);
 }
 
@@ -0,0 +1,28 @@
+#include "ast.h"
+#include "../obj/obj.h"
+
+int compile_dot(struct node *n, struct compiler *c) {
+	struct dot_node *d = n->data;
+
+	CHECK(d->left->compile(d->left, c));
+	CHECK(compiler_emit(c, op_constant, compiler_add_const(c, new_string_obj(d->field, d->len))));
+	return compiler_emit(c, op_dot);
+}
+
+void dispose_dot_node(struct node *n) {
+	struct dot_node *d = n->data;
+	if (d->left != NULL) d->left->dispose(d->left);
+
+	free(d->field);
+	free(d);
+	free(n);
+}
+
+struct node *new_dot(struct node *left, char *field, size_t len) {
+	struct dot_node *d = malloc(sizeof(struct dot_node));
+	d->left = left;
+	d->field = field;
+	d->len = len;
+
+	return new_node(d, dot_node_t, compile_dot, dispose_dot_node);
+}
@@ -23,18 +23,34 @@ int compile_function(struct node *n, struct compiler *c) {
 	if (!compiler_last_is(c, op_return_value)) {
 		compiler_emit(c, op_return);
 	}
+	compiler_mark_tail_calls(c);
 
-	struct symbol **free_symbols = c->st->free_symbols;
+	// The free symbols are the ones of the enclosing scope, from which
+	// the closure captures the variables when it's created.
 	size_t nfree = c->st->nfree;
+	struct capture *captures = malloc(sizeof(struct capture) * nfree);
+	for (int i = 0; i < nfree; i++) {
+		struct symbol *s = c->st->free_symbols[i];
+		captures[i] = (struct capture) {.local = s->scope == local_scope, .index = s->index};
+	}
+
 	int num_locals = c->st->num_defs;
 	size_t inslen = 0;
 	uint8_t *insts = compiler_leave_scope(c, &inslen);
+	int max_stack = max_stack_depth(insts, inslen);
+	struct object *fnobj = new_function_obj(insts, inslen, num_locals, fn->nparams, max_stack);
+	fnobj->data.fn->num_free = nfree;
+	fnobj->data.fn->captures = captures;
 
-	for (int i = 0; i < nfree; i++) {
-		CHECK(compiler_load_symbol(c, free_symbols[i]));
+	// Functions that don't capture anything are turned into closures
+	// once at compile time instead of each time they're evaluated.
+	// The closure takes over the function and its object isn't needed.
+	if (nfree == 0) {
+		struct object *cl = new_closure_obj(fnobj->data.fn, NULL, 0);
+		free(fnobj);
+		return compiler_emit(c, op_constant, compiler_add_const(c, cl));
 	}
 
-	struct object *fnobj = new_function_obj(insts, inslen, num_locals, fn->nparams);
 	int fnpos = compiler_add_const(c, fnobj);
 	return compiler_emit(c, op_closure, fnpos, nfree);
 }
@@ -8,6 +8,8 @@ struct greater_node {
 int compile_greater(struct node *n, struct compiler *c) {
 	struct greater_node *g = n->data;
 
+	mark_noescape(g->l);
+	mark_noescape(g->r);
 	CHECK(g->l->compile(g->l, c));
 	CHECK(g->r->compile(g->r, c));
 	return compiler_emit(c, op_greater_than);
@@ -9,8 +9,10 @@ struct ifelse_node {
 int compile_ifelse(struct node *n, struct compiler *c) {
 	struct ifelse_node *ie = n->data;
 
+	mark_noescape(ie->cond);
 	CHECK(ie->cond->compile(ie->cond, c));
 	int jump_not_truthy_pos = compiler_emit(c, op_jump_not_truthy, 9999);
+	c->branch_depth++;
 	CHECK(ie->body->compile(ie->body, c));
 
 	if (compiler_last_is(c, op_pop)) {
@@ -29,6 +31,7 @@ int compile_ifelse(struct node *n, struct compiler *c) {
 	} else {
 		compiler_emit(c, op_null);
 	}
+	c->branch_depth--;
 
 	compiler_replace_operand(c, jump_pos, compiler_pos(c));
 	return compiler_pos(c);
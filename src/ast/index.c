@@ -0,0 +1,28 @@
+#include "ast.h"
+
+int compile_index(struct node *n, struct compiler *c) {
+	struct index_node *i = n->data;
+
+	// The index is only used for the lookup.
+	mark_noescape(i->index);
+	CHECK(i->left->compile(i->left, c));
+	CHECK(i->index->compile(i->index, c));
+	return compiler_emit(c, op_index);
+}
+
+void dispose_index_node(struct node *n) {
+	struct index_node *i = n->data;
+	if (i->left != NULL) i->left->dispose(i->left);
+	if (i->index != NULL) i->index->dispose(i->index);
+
+	free(i);
+	free(n);
+}
+
+struct node *new_index(struct node *left, struct node *index) {
+	struct index_node *i = malloc(sizeof(struct index_node));
+	i->left = left;
+	i->index = index;
+
+	return new_node(i, index_node_t, compile_index, dispose_index_node);
+}
@@ -0,0 +1,54 @@
+#include "ast.h"
+#include "../obj/obj.h"
+
+// String literal split into nexprs+1 literal parts and nexprs expressions.
+struct interpolated_node {
+	char **parts;
+	size_t *lens;
+	struct node **exprs;
+	size_t nexprs;
+};
+
+int compile_interpolated(struct node *n, struct compiler *c) {
+	struct interpolated_node *in = n->data;
+
+	for (int i = 0; i < in->nexprs; i++) {
+		CHECK(in->exprs[i]->compile(in->exprs[i], c));
+	}
+
+	// The literal parts are stored as consecutive constants so that the VM
+	// finds them all from the index of the first one.
+	int first = compiler_add_const(c, new_string_obj(in->parts[0], in->lens[0]));
+	for (int i = 1; i <= in->nexprs; i++) {
+		compiler_add_const(c, new_string_obj(in->parts[i], in->lens[i]));
+	}
+
+	return compiler_emit(c, op_interpolate, first, in->nexprs);
+}
+
+void dispose_interpolated_node(struct node *n) {
+	struct interpolated_node *in = n->data;
+
+	for (int i = 0; i < in->nexprs; i++) {
+		in->exprs[i]->dispose(in->exprs[i]);
+	}
+	for (int i = 0; i <= in->nexprs; i++) {
+		free(in->parts[i]);
+	}
+
+	free(in->parts);
+	free(in->lens);
+	free(in->exprs);
+	free(in);
+	free(n);
+}
+
+struct node *new_interpolated(char **parts, size_t *lens, struct node **exprs, size_t nexprs) {
+	struct interpolated_node *in = malloc(sizeof(struct interpolated_node));
+	in->parts = parts;
+	in->lens = lens;
+	in->exprs = exprs;
+	in->nexprs = nexprs;
+
+	return new_node(in, interpolated_node_t, compile_interpolated, dispose_interpolated_node);
+}
@@ -8,6 +8,9 @@ struct less_node {
 int compile_less(struct node *n, struct compiler *c) {
 	struct less_node *l = n->data;
 
+	mark_noescape(l->l);
+	mark_noescape(l->r);
+
 	// The order of the compilation of the operands is inverted
 	// since we reuse the op_greater_than opcode.
 	CHECK(l->r->compile(l->r, c));
@@ -8,6 +8,8 @@ struct less_eq_node {
 int compile_less_eq(struct node *n, struct compiler *c) {
 	struct less_eq_node *ln = n->data;
 
+	mark_noescape(ln->l);
+	mark_noescape(ln->r);
 	// The order of the compilation of the operands is inverted
 	// since we reuse the op_greater_than opcode.
 	CHECK(ln->r->compile(ln->r, c));
@@ -0,0 +1,35 @@
+#include "ast.h"
+
+struct list_node {
+	struct node **elems;
+	size_t len;
+};
+
+int compile_list(struct node *n, struct compiler *c) {
+	struct list_node *l = n->data;
+
+	for (int i = 0; i < l->len; i++) {
+		CHECK(l->elems[i]->compile(l->elems[i], c));
+	}
+	return compiler_emit(c, op_list, l->len);
+}
+
+void dispose_list_node(struct node *n) {
+	struct list_node *l = n->data;
+
+	for (int i = 0; i < l->len; i++) {
+		l->elems[i]->dispose(l->elems[i]);
+	}
+
+	free(l->elems);
+	free(l);
+	free(n);
+}
+
+struct node *new_list(struct node **elems, size_t len) {
+	struct list_node *l = malloc(sizeof(struct list_node));
+	l->elems = elems;
+	l->len = len;
+
+	return new_node(l, list_node_t, compile_list, dispose_list_node);
+}
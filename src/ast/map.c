@@ -0,0 +1,43 @@
+#include "ast.h"
+
+struct map_node {
+	struct node **keys;
+	struct node **vals;
+	size_t len;
+};
+
+int compile_map(struct node *n, struct compiler *c) {
+	struct map_node *m = n->data;
+
+	for (int i = 0; i < m->len; i++) {
+		CHECK(m->keys[i]->compile(m->keys[i], c));
+		CHECK(m->vals[i]->compile(m->vals[i], c));
+	}
+
+	// The operand is the number of elements on the stack, keys and values
+	// included, and it's used by the VM to pre-size the map.
+	return compiler_emit(c, op_map, m->len * 2);
+}
+
+void dispose_map_node(struct node *n) {
+	struct map_node *m = n->data;
+
+	for (int i = 0; i < m->len; i++) {
+		m->keys[i]->dispose(m->keys[i]);
+		m->vals[i]->dispose(m->vals[i]);
+	}
+
+	free(m->keys);
+	free(m->vals);
+	free(m);
+	free(n);
+}
+
+struct node *new_map(struct node **keys, struct node **vals, size_t len) {
+	struct map_node *m = malloc(sizeof(struct map_node));
+	m->keys = keys;
+	m->vals = vals;
+	m->len = len;
+
+	return new_node(m, map_node_t, compile_map, dispose_map_node);
+}
@@ -8,10 +8,12 @@ struct minus_node {
 int compile_minus(struct node *n, struct compiler *c) {
 	struct minus_node *m = n->data;
 
+	mark_noescape(m->l);
+	mark_noescape(m->r);
 	CHECK(m->l->compile(m->l, c));
 	CHECK(m->r->compile(m->r, c));
 
-	return compiler_emit(c, op_sub);
+	return compiler_emit(c, n->noescape ? op_sub_tmp : op_sub);
 }
 
 void dispose_minus_node(struct node *n) {
@@ -4,6 +4,7 @@ struct node *new_node(void *data, enum node_type t, compilefn cfn, disposefn dfn
 	struct node *n = malloc(sizeof(struct node));
 	n->data = data;
 	n->type = t;
+	n->noescape = 0;
 	n->compile = cfn;
 	n->dispose = dfn;
 
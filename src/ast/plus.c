@@ -8,10 +8,14 @@ struct plus_node {
 int compile_plus(struct node *n, struct compiler *c) {
 	struct plus_node *p = n->data;
 
+	// The operands are consumed by the operator and never stored, so
+	// intermediate sums are allocated in the frame's region.
+	mark_noescape(p->l);
+	mark_noescape(p->r);
 	CHECK(p->l->compile(p->l, c));
 	CHECK(p->r->compile(p->r, c));
 
-	return compiler_emit(c, op_add);
+	return compiler_emit(c, n->noescape ? op_add_tmp : op_add);
 }
 
 void dispose_plus_node(struct node *n) {
@@ -0,0 +1,29 @@
+#include "ast.h"
+#include "../obj/obj.h"
+
+struct string_node {
+	char *str;
+	size_t len;
+};
+
+int compile_string(struct node *n, struct compiler *c) {
+	struct string_node *s = n->data;
+	int pos = compiler_add_const(c, new_string_obj(s->str, s->len));
+	return compiler_emit(c, op_constant, pos);
+}
+
+void dispose_string_node(struct node *n) {
+	struct string_node *s = n->data;
+
+	free(s->str);
+	free(s);
+	free(n);
+}
+
+struct node *new_string(char *str, size_t len) {
+	struct string_node *s = malloc(sizeof(struct string_node));
+	s->str = str;
+	s->len = len;
+
+	return new_node(s, string_node_t, compile_string, dispose_string_node);
+}
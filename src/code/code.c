@@ -94,6 +94,138 @@ inline uint32_t read_uint32(uint8_t *ins) {
 	return (ins[0] << 24) | (ins[1] << 16) | (ins[2] << 8) | ins[3];
 }
 
+// Returns the length of the instruction including its operands.
+size_t instruction_len(enum opcode op) {
+	struct definition def = definitions[op];
+	size_t len = 1;
+
+	for (int i = 0; i < def.noperands; i++) {
+		len += def.opwidths[i];
+	}
+	return len;
+}
+
+// Returns how many values the instruction pushes minus how many it pops.
+static inline int stack_effect(uint8_t *ins) {
+	switch (ins[0]) {
+	case op_constant:
+	case op_true:
+	case op_false:
+	case op_null:
+	case op_current_closure:
+	case op_closure:
+	case op_get_global:
+	case op_get_local:
+	case op_get_builtin:
+	case op_get_free:
+		return 1;
+
+	case op_list:
+	case op_map:
+		return 1 - read_uint16(&ins[1]);
+	case op_interpolate:
+		return 1 - read_uint16(&ins[3]);
+
+	case op_call:
+	case op_tail_call:
+	case op_concurrent_call:
+		return -read_uint8(&ins[1]);
+	case op_call_builtin:
+		return 1 - read_uint8(&ins[2]);
+
+	case op_add:
+	case op_sub:
+	case op_mul:
+	case op_div:
+	case op_mod:
+	case op_add_tmp:
+	case op_sub_tmp:
+	case op_bw_and:
+	case op_bw_or:
+	case op_bw_xor:
+	case op_bw_lshift:
+	case op_bw_rshift:
+	case op_and:
+	case op_or:
+	case op_equal:
+	case op_not_equal:
+	case op_greater_than:
+	case op_greater_than_equal:
+	case op_index:
+	case op_dot:
+	case op_jump_not_truthy:
+	case op_return_value:
+	case op_pop:
+		return -1;
+
+	case op_define:
+		return -2;
+
+	default:
+		return 0;
+	}
+}
+
+// Returns the maximum number of values the bytecode keeps on the stack
+// at once, following every path through the jumps.
+size_t max_stack_depth(uint8_t *insts, size_t len) {
+	int *depths = malloc(sizeof(int) * (len + 1));
+	size_t *pending = malloc(sizeof(size_t) * (len + 1));
+	size_t npending = 0;
+	int max = 0;
+
+	for (size_t i = 0; i <= len; i++) {
+		depths[i] = -1;
+	}
+	depths[0] = 0;
+	pending[npending++] = 0;
+
+	while (npending > 0) {
+		size_t i = pending[--npending];
+		int depth = depths[i];
+
+		while (i < len) {
+			uint8_t op = insts[i];
+			size_t next = i + instruction_len(op);
+
+			depth += stack_effect(&insts[i]);
+			if (depth > max) {
+				max = depth;
+			}
+
+			switch (op) {
+			case op_jump:
+				next = read_uint16(&insts[i+1]);
+				break;
+			case op_jump_not_truthy: {
+				size_t target = read_uint16(&insts[i+1]);
+				if (depths[target] == -1) {
+					depths[target] = depth;
+					pending[npending++] = target;
+				}
+				break;
+			}
+			case op_tail_call:
+			case op_return:
+			case op_return_value:
+			case op_halt:
+				next = len;
+				break;
+			}
+
+			if (next >= len || depths[next] != -1) {
+				break;
+			}
+			depths[next] = depth;
+			i = next;
+		}
+	}
+
+	free(depths);
+	free(pending);
+	return max;
+}
+
 // Decodes the operands of a bytecode instruction.
 int read_operands(struct definition def, uint8_t *ins, int **operands) {
 	*operands = realloc(*operands, sizeof(int) * def.noperands);
@@ -133,6 +265,8 @@ char *opcode_str(enum opcode op) {
 		"op_mul",
 		"op_div",
 		"op_mod",
+		"op_add_tmp",
+		"op_sub_tmp",
 
 		"op_bw_and",
 		"op_bw_or",
@@ -153,6 +287,8 @@ char *opcode_str(enum opcode op) {
 		"op_index",
 
 		"op_call",
+		"op_call_builtin",
+		"op_tail_call",
 		"op_concurrent_call",
 		"op_return",
 		"op_return_value",
@@ -168,6 +304,7 @@ char *opcode_str(enum opcode op) {
 		"op_set_local",
 		"op_get_builtin",
 		"op_get_free",
+		"op_set_free",
 		"op_load_module",
 		"op_interpolate",
 
@@ -193,6 +330,8 @@ struct definition definitions[NUM_OPCODES] = {
 	{"op_mul", (int[1]) {0}, 0},
 	{"op_div", (int[1]) {0}, 0},
 	{"op_mod", (int[1]) {0}, 0},
+	{"op_add_tmp", (int[1]) {0}, 0},
+	{"op_sub_tmp", (int[1]) {0}, 0},
 
 	{"op_bw_and", (int[1]) {0}, 0},
 	{"op_bw_or", (int[1]) {0}, 0},
@@ -213,6 +352,8 @@ struct definition definitions[NUM_OPCODES] = {
 	{"op_index", (int[1]) {0}, 0},
 
 	{"op_call", (int[1]) {1}, 1},
+	{"op_call_builtin", (int[2]) {1, 1}, 2},
+	{"op_tail_call", (int[1]) {1}, 1},
 	{"op_concurrent_call", (int[1]) {1}, 1},
 	{"op_return", (int[1]) {0}, 0},
 	{"op_return_value", (int[1]) {0}, 0},
@@ -228,6 +369,7 @@ struct definition definitions[NUM_OPCODES] = {
 	{"op_set_local", (int[1]) {1}, 1},
 	{"op_get_builtin", (int[1]) {1}, 1},
 	{"op_get_free", (int[1]) {1}, 1},
+	{"op_set_free", (int[1]) {1}, 1},
 	{"op_load_module", (int[1]) {0}, 0},
 	{"op_interpolate", (int[2]) {2, 2}, 2},
 
@@ -5,7 +5,7 @@
 #include <stddef.h>
 #include <stdarg.h>
 
-#define NUM_OPCODES 46
+#define NUM_OPCODES 51
 
 enum opcode {
 	op_constant,
@@ -22,6 +22,8 @@ enum opcode {
 	op_mul,
 	op_div,
 	op_mod,
+	op_add_tmp,
+	op_sub_tmp,
 
 	op_bw_and,
 	op_bw_or,
@@ -42,6 +44,8 @@ enum opcode {
 	op_index,
 
 	op_call,
+	op_call_builtin,
+	op_tail_call,
 	op_concurrent_call,
 	op_return,
 	op_return_value,
@@ -57,6 +61,7 @@ enum opcode {
 	op_set_local,
 	op_get_builtin,
 	op_get_free,
+	op_set_free,
 	op_load_module,
 	op_interpolate,
 
@@ -75,6 +80,8 @@ extern struct definition definitions[NUM_OPCODES];
 int lookup_def(enum opcode op, struct definition *def);
 size_t make_bcode(uint8_t **code, size_t code_len, enum opcode op, ...);
 size_t vmake_bcode(uint8_t **code, size_t code_len, enum opcode op, va_list operands);
+size_t instruction_len(enum opcode op);
+size_t max_stack_depth(uint8_t *insts, size_t len);
 int read_operands(struct definition def, uint8_t *ins, int **operands);
 char *opcode_str(enum opcode op);
 
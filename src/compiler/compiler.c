@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include "compiler.h"
+#include "../ir/ir.h"
 
 int compiler_add_inst(struct compiler *c, uint8_t *ins, size_t len) {
 	struct scope *scope = &c->scopes[c->nscopes-1];
@@ -149,6 +151,28 @@ void compiler_replace_last_pop_with_return(struct compiler *c) {
 	c->scopes[c->scope_index].last_inst.opcode = op_return_value;
 }
 
+// Turns the calls whose result is directly returned into tail calls,
+// following the unconditional jumps that lead to the return such as the
+// ones at the end of the if-else branches.
+void compiler_mark_tail_calls(struct compiler *c) {
+	uint8_t *insts = c->scopes[c->scope_index].insts;
+	size_t len = c->scopes[c->scope_index].len;
+
+	for (size_t i = 0; i < len; i += instruction_len(insts[i])) {
+		if (insts[i] != op_call) {
+			continue;
+		}
+
+		size_t next = i + instruction_len(op_call);
+		for (int hops = 0; next < len && insts[next] == op_jump && hops < 8; hops++) {
+			next = read_uint16(&insts[next+1]);
+		}
+		if (next < len && insts[next] == op_return_value) {
+			insts[i] = op_tail_call;
+		}
+	}
+}
+
 void compiler_enter_scope(struct compiler *c) {
 	c->scopes = realloc(c->scopes, sizeof(struct scope) * ++c->nscopes);
 	c->scope_index++;
@@ -172,8 +196,95 @@ int compiler_pos(struct compiler *c) {
 	return c->scopes[c->scope_index].len;
 }
 
+// Counts the assignment of the global, whose value is compiled from
+// start, remembering the constant assigned if the value is only that and
+// the assignment is in the straight-line code of the top level.
+void compiler_count_assign(struct compiler *c, struct symbol *s, int start) {
+	struct scope *scope = &c->scopes[c->scope_index];
+
+	s->nassigns++;
+	s->const_idx = -1;
+	if (c->scope_index == 0 && c->branch_depth == 0 && scope->len - start == 3 && scope->insts[start] == op_constant) {
+		s->const_idx = read_uint16(&scope->insts[start+1]);
+	}
+}
+
+static inline int is_constant_global(struct symbol *s) {
+	return s->nassigns == 1 && s->const_idx != -1;
+}
+
+// Replaces the reads of the globals that are constant with the constant.
+static void fold_globals(struct compiler *c, uint8_t *insts, size_t len) {
+	for (size_t i = 0; i < len; i += instruction_len(insts[i])) {
+		if (insts[i] != op_get_global) {
+			continue;
+		}
+
+		struct symbol *s = c->st->defs[read_uint16(&insts[i+1])];
+		if (is_constant_global(s)) {
+			insts[i] = op_constant;
+			insts[i+1] = s->const_idx >> 8;
+			insts[i+2] = s->const_idx & 0xff;
+			s->folded = 1;
+		}
+	}
+}
+
+// Folds the constant globals in the function's original code and runs
+// it through the optimizer.
+static void specialize(struct compiler *c, struct function *fn) {
+	uint8_t *orig = fn->orig_instructions != NULL ? fn->orig_instructions : fn->instructions;
+	size_t len = fn->orig_instructions != NULL ? fn->orig_len : fn->len;
+	int num_locals = fn->orig_instructions != NULL ? fn->orig_num_locals : fn->num_locals;
+
+	uint8_t *insts = malloc(len);
+	memcpy(insts, orig, len);
+	fold_globals(c, insts, len);
+
+	struct ir_inliner inl = {
+		.consts = *c->consts,
+		.self = fn,
+		.threshold = c->inline_threshold,
+		.report = c->inline_report
+	};
+	ir_optimize(&insts, &len, &num_locals, fn->num_params, &inl);
+	function_specialize(fn, insts, len, num_locals);
+}
+
+// Specializes the functions compiled to the globals that are assigned
+// only once, a constant, as far as the code compiled so far goes. The
+// functions are taken in the order they're compiled, so the ones they
+// call are done first, nested ones at least. A global folded by an
+// earlier REPL line and assigned again by this one invalidates what was
+// folded, so all of the functions are specialized again without it
+// before this line runs.
+static void compiler_specialize(struct compiler *c) {
+	size_t first = c->first_const;
+
+	for (int i = 0; i < c->st->num_defs; i++) {
+		struct symbol *s = c->st->defs[i];
+		if (s->folded && !is_constant_global(s)) {
+			s->folded = 0;
+			first = 0;
+		}
+	}
+
+	fold_globals(c, c->scopes[c->scope_index].insts, c->scopes[c->scope_index].len);
+	for (size_t i = first; i < c->nconsts; i++) {
+		struct object *o = (*c->consts)[i];
+		if (o->type == obj_closure) {
+			specialize(c, o->data.cl->fn);
+		} else if (o->type == obj_function) {
+			specialize(c, o->data.fn);
+		}
+	}
+}
+
 int compile(struct compiler *c, struct node *tree) {
 	tree->compile(tree, c);
+	if (c->optimize) {
+		compiler_specialize(c);
+	}
 	return compiler_emit(c, op_halt);
 }
 
@@ -207,7 +318,9 @@ struct bytecode compiler_bytecode(struct compiler *c) {
 		.insts = c->scopes[c->scope_index].insts,
 		.consts = *c->consts,
 		.len = c->scopes[c->scope_index].len,
-		.nconsts = c->nconsts
+		.nconsts = c->nconsts,
+		.max_stack = max_stack_depth(c->scopes[c->scope_index].insts, c->scopes[c->scope_index].len),
+		.nglobals = c->st->num_defs
 	};
 }
 
@@ -216,9 +329,11 @@ struct compiler *new_compiler_with_state(struct symbol_table *st, struct object
 	c->st = st;
 	c->consts = consts;
 	c->nconsts = nconsts;
+	c->first_const = nconsts;
 	c->scopes = malloc(sizeof(struct scope));
 	c->scopes[0] = (struct scope) {0};
 	c->nscopes = 1;
+	c->inline_threshold = IR_INLINE_THRESHOLD;
 
 	return c;
 }
@@ -229,10 +344,11 @@ struct compiler *new_compiler() {
 	c->scopes = malloc(sizeof(struct scope));
 	c->scopes[0] = (struct scope) {0};
 	c->nscopes = 1;
+	c->inline_threshold = IR_INLINE_THRESHOLD;
 	// TODO: find an elegant way to free this address.
 	c->consts = calloc(1, sizeof(struct object **));
+	symbol_table_define_builtins(c->st);
 
-	//TODO: define builtins.
 	return c;
 }
 
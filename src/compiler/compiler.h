@@ -24,11 +24,18 @@ struct symbol {
 	char *name;
 	enum symbol_scope scope;
 	int index;
+	// Of the globals: the assignments compiled so far, the constant the
+	// value is if it's assigned once to a literal at the top level or -1,
+	// and whether the reads were replaced by it.
+	int nassigns;
+	int const_idx;
+	int folded;
 };
 
 struct symbol_table {
 	struct symbol_table *outer;
 	strmap store;
+	struct symbol **defs; // by index
 	struct symbol **free_symbols;
 	size_t nfree;
 	int num_defs;
@@ -49,10 +56,21 @@ struct scope {
 struct compiler {
 	struct object ***consts;
 	size_t nconsts;
+	size_t first_const; // the ones before are of the earlier REPL lines
 	struct scope *scopes;
 	size_t nscopes;
 	int scope_index;
+	// Number of if branches being compiled, whose assignments might not
+	// run before the reads that follow.
+	int branch_depth;
 	struct symbol_table *st;
+	// Whether the globals assigned once are folded and the functions go
+	// through the SSA optimizer.
+	int optimize;
+	// Longest function inlined by the optimizer, and whether it prints
+	// the inlined call sites.
+	size_t inline_threshold;
+	int inline_report;
 };
 
 struct bytecode {
@@ -60,6 +78,8 @@ struct bytecode {
 	struct object **consts;
 	size_t len;
 	size_t nconsts;
+	size_t max_stack;
+	size_t nglobals; // globals defined so far
 };
 
 struct node;
@@ -76,12 +96,14 @@ void compiler_replace_operand(struct compiler *c, int op_pos, int operand);
 int compiler_replace_continue_operand(struct compiler *c, int start, int end, int operand);
 int compiler_replace_break_operand(struct compiler *c, int start, int end, int operand);
 void compiler_replace_last_pop_with_return(struct compiler *c);
+void compiler_mark_tail_calls(struct compiler *c);
 void compiler_enter_scope(struct compiler *c);
 uint8_t *compiler_leave_scope(struct compiler *c, size_t *len);
 int compiler_pos(struct compiler *c);
 struct symbol *compiler_define(struct compiler *c, char *name);
 int compiler_load_symbol(struct compiler *c, struct symbol *s);
 struct symbol *compiler_resolve(struct compiler *c, char *name);
+void compiler_count_assign(struct compiler *c, struct symbol *s, int start);
 struct bytecode compiler_bytecode(struct compiler *c);
 struct compiler *new_compiler_with_state(struct symbol_table *st, struct object ***consts, size_t nconsts);
 struct compiler *new_compiler();
@@ -93,5 +115,7 @@ struct symbol_table *new_enclosed_symbol_table(struct symbol_table *outer);
 void symbol_table_free(struct symbol_table *s);
 struct symbol *symbol_table_define(struct symbol_table *s, char *name);
 struct symbol *symbol_table_resolve(struct symbol_table *s, char *name);
+struct symbol *symbol_table_define_builtin(struct symbol_table *s, int index, char *name);
+void symbol_table_define_builtins(struct symbol_table *s);
 
 #endif
@@ -1,9 +1,10 @@
 #include <stdlib.h>
+#include <string.h>
 #include "compiler.h"
 
 struct symbol *new_symbol(char *name, enum symbol_scope scope, int index) {
 	struct symbol *s = calloc(1, sizeof(struct symbol));
-	s->name = name;
+	s->name = strdup(name);
 	s->scope = scope;
 	s->index = index;
 
@@ -18,22 +19,34 @@ void symbol_free(struct symbol *s) {
 struct symbol *symbol_table_define(struct symbol_table *s, char *name) {
 	struct symbol *symbol = strmap_get(s->store, name);
 
-	if (symbol!= NULL) {
+	if (symbol != NULL && symbol->scope != builtin_scope) {
 		return symbol;
 	}
 
 	enum symbol_scope scope = s->outer != NULL ? local_scope : global_scope;
-	symbol = new_symbol(name, scope, s->num_defs);
-	strmap_set(&s->store, name, symbol);
-	s->num_defs++;
+	if (symbol != NULL) {
+		// A global shadowing a builtin takes over its symbol, the code
+		// compiled before still calls the builtin by index.
+		symbol->scope = scope;
+		symbol->index = s->num_defs;
+	} else {
+		symbol = new_symbol(name, scope, s->num_defs);
+		strmap_set(&s->store, symbol->name, symbol);
+	}
+	symbol->const_idx = -1;
+	s->defs = realloc(s->defs, sizeof(struct symbol *) * (s->num_defs + 1));
+	s->defs[s->num_defs++] = symbol;
 	return symbol;
 }
 
+// Keeps track of the symbol of the enclosing scope so that the closure
+// can load it when it's created, and defines it as free in this one.
 struct symbol *symbol_table_define_free(struct symbol_table *s, struct symbol *original) {
-	struct symbol *symbol = new_symbol(original->name, s->nfree, free_scope);
-
 	s->free_symbols = realloc(s->free_symbols, sizeof(struct symbol *) * ++s->nfree);
-	s->free_symbols[s->nfree-1] = symbol;
+	s->free_symbols[s->nfree-1] = original;
+
+	struct symbol *symbol = new_symbol(original->name, free_scope, s->nfree-1);
+	strmap_set(&s->store, symbol->name, symbol);
 	return symbol;
 }
 
@@ -59,13 +72,19 @@ struct symbol *symbol_table_resolve(struct symbol_table *s, char *name) {
 	return NULL;
 }
 
-struct symbol *define_builtin(struct symbol_table *s, int index, char *name) {
-	struct symbol *symbol = new_symbol(name, index, builtin_scope);
-	strmap_set(&s->store, name, symbol);
+struct symbol *symbol_table_define_builtin(struct symbol_table *s, int index, char *name) {
+	struct symbol *symbol = new_symbol(name, builtin_scope, index);
+	strmap_set(&s->store, symbol->name, symbol);
 	
 	return symbol;
 }
 
+void symbol_table_define_builtins(struct symbol_table *s) {
+	for (int i = 0; i < NUM_BUILTINS; i++) {
+		symbol_table_define_builtin(s, i, builtins[i].name);
+	}
+}
+
 struct symbol_table *new_symbol_table() {
 	return calloc(1, sizeof(struct symbol_table));
 }
@@ -82,13 +101,10 @@ static void _strmap_symbol_free(char *key, void *val) {
 	free(val);
 }
 
+// The free symbols belong to the enclosing symbol tables.
 void symbol_table_free(struct symbol_table *s) {
 	strmap_free_fn(s->store, _strmap_symbol_free);
-
-	for (int i = 0; i < s->nfree; i++) {
-		symbol_free(s->free_symbols[i]);
-	}
-
+	free(s->defs);
 	free(s->free_symbols);
 	free(s);
 }
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "../obj/obj.h"
+
+static inline void add_pred(struct ir_block *blk, uint32_t pred) {
+	blk->preds = realloc(blk->preds, sizeof(uint32_t) * (blk->npreds + 1));
+	blk->preds[blk->npreds++] = pred;
+}
+
+static uint32_t add_block(struct ir_func *f, uint32_t start) {
+	f->blocks = realloc(f->blocks, sizeof(struct ir_block) * (f->nblocks + 1));
+	f->blocks[f->nblocks] = (struct ir_block) {.start = start, .idom = IR_NONE, .rpo = -1};
+	return f->nblocks++;
+}
+
+// Returns the function the call goes to if it can be inlined: a
+// constant closure other than the caller small enough, taking as many
+// arguments as given and not calling itself through op_current_closure.
+static struct function *inline_callee(struct ir_func *f, struct ir_inst *call, struct ir_inliner *inl) {
+	struct ir_inst *callee = &f->insts[call->args[0]];
+	if (callee->op != op_constant) {
+		return NULL;
+	}
+
+	struct object *o = inl->consts[callee->imm[0]];
+	if (o->type != obj_closure) {
+		return NULL;
+	}
+
+	struct function *fn = o->data.cl->fn;
+	if (fn == inl->self || fn->num_free > 0 || fn->num_params != call->imm[0] || fn->len > inl->threshold) {
+		return NULL;
+	}
+	for (size_t i = 0; i < fn->len; i += instruction_len(fn->instructions[i])) {
+		if (fn->instructions[i] == op_current_closure) {
+			return NULL;
+		}
+	}
+	return fn;
+}
+
+// Moves what follows the instruction in its block to a new block,
+// which takes over the successors. Returns the new block.
+static uint32_t split_after(struct ir_func *f, uint32_t id) {
+	uint32_t b = f->insts[id].block;
+	uint32_t next = add_block(f, f->blocks[b].start);
+	struct ir_block *blk = &f->blocks[b];
+	struct ir_block *nblk = &f->blocks[next];
+
+	size_t at = 0;
+	while (blk->insts[at] != id) at++;
+	nblk->ninsts = blk->ninsts - at - 1;
+	nblk->insts = malloc(sizeof(uint32_t) * (nblk->ninsts + 1));
+	memcpy(nblk->insts, &blk->insts[at+1], sizeof(uint32_t) * nblk->ninsts);
+	blk->ninsts = at + 1;
+	for (size_t i = 0; i < nblk->ninsts; i++) {
+		f->insts[nblk->insts[i]].block = next;
+	}
+
+	nblk->nsuccs = blk->nsuccs;
+	memcpy(nblk->succs, blk->succs, sizeof(blk->succs));
+	blk->nsuccs = 0;
+	for (int i = 0; i < nblk->nsuccs; i++) {
+		struct ir_block *s = &f->blocks[nblk->succs[i]];
+		for (size_t j = 0; j < s->npreds; j++) {
+			if (s->preds[j] == b) s->preds[j] = next;
+		}
+	}
+	return next;
+}
+
+// Replaces the call with the callee's body. The parameters become the
+// arguments and the returns go to the rest of the caller's block, where
+// a phi merges the returned values. The callee's tail calls are plain
+// calls once inlined. A tail call is replaced by the body as it is
+// instead, since the callee returns what the caller does. Returns 0 if
+// the callee can't be lifted.
+static int inline_call(struct ir_func *f, uint32_t id, struct function *fn) {
+	struct ir_func *g = ir_build(fn->instructions, fn->len, fn->num_locals, fn->num_params);
+	if (g == NULL) {
+		return 0;
+	}
+
+	uint32_t *args = malloc(sizeof(uint32_t) * f->insts[id].nargs);
+	memcpy(args, f->insts[id].args, sizeof(uint32_t) * f->insts[id].nargs);
+	uint32_t offset = f->insts[id].offset;
+	uint32_t b = f->insts[id].block;
+	int tail = f->insts[id].op == op_tail_call;
+	uint32_t rest = tail ? IR_NONE : split_after(f, id);
+	// The call's own block ends with it, so it's left out.
+	f->blocks[b].ninsts--;
+
+	uint32_t *bmap = malloc(sizeof(uint32_t) * g->nblocks);
+	uint32_t *imap = malloc(sizeof(uint32_t) * g->ninsts);
+	uint32_t *rets = malloc(sizeof(uint32_t) * (g->norder + 1));
+	size_t nrets = 0;
+
+	for (size_t o = 0; o < g->norder; o++) {
+		bmap[g->order[o]] = add_block(f, f->blocks[b].start);
+	}
+	for (size_t o = 0; o < g->norder; o++) {
+		uint32_t gb = g->order[o];
+		struct ir_block *gblk = &g->blocks[gb];
+		uint32_t nb = bmap[gb];
+
+		for (size_t i = 0; i < gblk->ninsts; i++) {
+			uint32_t gi = gblk->insts[i];
+			struct ir_inst *gins = &g->insts[gi];
+
+			if (gins->op == ir_param) {
+				imap[gi] = args[1 + gins->imm[0]];
+				continue;
+			}
+
+			uint16_t op = gins->op;
+			int ret = op == op_return_value || op == op_return || op == op_tail_call;
+			if (ret && !tail) {
+				rets[nrets++] = gi;
+				if (op == op_return_value) {
+					imap[gi] = IR_NONE;
+					continue;
+				}
+				op = op == op_return ? op_null : op_call;
+			}
+
+			uint32_t ni = ir_add_inst(f, nb, op, op == op_null ? 0 : gins->nargs);
+			f->insts[ni].imm[0] = gins->imm[0];
+			f->insts[ni].imm[1] = gins->imm[1];
+			f->insts[ni].offset = offset;
+			imap[gi] = ni;
+		}
+
+		struct ir_block *nblk = &f->blocks[nb];
+		for (size_t j = 0; j < gblk->npreds; j++) {
+			add_pred(nblk, bmap[gblk->preds[j]]);
+		}
+		nblk->nsuccs = gblk->nsuccs;
+		for (int j = 0; j < gblk->nsuccs; j++) {
+			nblk->succs[j] = bmap[gblk->succs[j]];
+		}
+		if (gblk->nsuccs == 0 && !tail) {
+			nblk->succs[nblk->nsuccs++] = rest;
+			add_pred(&f->blocks[rest], nb);
+		}
+	}
+	// The arguments can refer to later instructions through the phis.
+	for (size_t i = 0; i < g->ninsts; i++) {
+		if (imap[i] == IR_NONE || g->insts[i].op == ir_param) continue;
+		for (uint32_t j = 0; j < g->insts[i].nargs; j++) {
+			f->insts[imap[i]].args[j] = imap[g->insts[i].args[j]];
+		}
+	}
+
+	f->blocks[b].succs[0] = bmap[0];
+	f->blocks[b].nsuccs = 1;
+	add_pred(&f->blocks[bmap[0]], b);
+
+	// The returns are in the same order as the predecessors they're in.
+	uint32_t value = IR_NONE;
+	if (tail) {
+		// Nothing uses the value of a tail call.
+	} else if (nrets == 0) {
+		value = ir_add_inst(f, b, ir_undef, 0);
+	} else if (nrets == 1) {
+		uint32_t r = rets[0];
+		value = g->insts[r].op == op_return_value ? imap[g->insts[r].args[0]] : imap[r];
+	} else {
+		struct ir_block *rblk = &f->blocks[rest];
+		value = ir_add_inst(f, rest, ir_phi, nrets);
+		memmove(&rblk->insts[1], &rblk->insts[0], sizeof(uint32_t) * (rblk->ninsts - 1));
+		rblk->insts[0] = value;
+		// The value is left on the stack like the compiler does for the
+		// value of an if.
+		f->insts[value].imm[0] = f->num_locals;
+		f->insts[value].imm[1] = 1;
+		for (size_t i = 0; i < nrets; i++) {
+			uint32_t r = rets[i];
+			f->insts[value].args[i] = g->insts[r].op == op_return_value ? imap[g->insts[r].args[0]] : imap[r];
+		}
+	}
+
+	f->insts[id].dead = 1;
+	if (value != IR_NONE) {
+		ir_replace_uses(f, id, value);
+	}
+
+	free(args);
+	free(bmap);
+	free(imap);
+	free(rets);
+	ir_dispose(g);
+	return 1;
+}
+
+// Inlines the calls to constant closures found in the function. The
+// calls in the inlined code are left as they are, though the callee's
+// own calls could have been inlined already when it was compiled.
+void ir_inline(struct ir_func *f, struct ir_inliner *inl) {
+	if (inl->threshold == 0) {
+		return;
+	}
+
+	// The calls are picked first since inlining moves them to new blocks.
+	uint32_t *calls = malloc(sizeof(uint32_t) * (f->ninsts + 1));
+	size_t ncalls = 0;
+	for (size_t i = 0; i < f->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[i];
+		int call = ins->op == op_call || ins->op == op_tail_call;
+		if (!ins->dead && call && f->blocks[ins->block].rpo != -1) {
+			calls[ncalls++] = i;
+		}
+	}
+
+	for (size_t c = 0; c < ncalls; c++) {
+		uint32_t i = calls[c];
+		struct function *fn = inline_callee(f, &f->insts[i], inl);
+		if (fn != NULL && inline_call(f, i, fn)) {
+			f->ninlined++;
+			if (inl->report) {
+				printf("inlined call at offset %u to a function of %zu bytes\n", f->insts[i].offset, fn->len);
+			}
+		}
+	}
+	if (f->ninlined > 0) {
+		ir_update_cfg(f);
+	}
+	free(calls);
+}
@@ -0,0 +1,1094 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+static inline void append(uint32_t **arr, size_t *len, uint32_t v) {
+	*arr = realloc(*arr, sizeof(uint32_t) * (*len + 1));
+	(*arr)[(*len)++] = v;
+}
+
+int ir_is_terminator(uint16_t op) {
+	switch (op) {
+	case op_jump:
+	case op_jump_not_truthy:
+	case op_return:
+	case op_return_value:
+	case op_tail_call:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Returns whether the operation always gives the same result for the
+// same arguments and doesn't change anything, so it can be computed
+// once. It might still fail on the wrong types.
+int ir_is_pure(uint16_t op) {
+	switch (op) {
+	case op_constant:
+	case op_true:
+	case op_false:
+	case op_null:
+	case op_get_builtin:
+	case op_current_closure:
+	case op_add:
+	case op_sub:
+	case op_mul:
+	case op_div:
+	case op_mod:
+	case op_add_tmp:
+	case op_sub_tmp:
+	case op_bw_and:
+	case op_bw_or:
+	case op_and:
+	case op_or:
+	case op_equal:
+	case op_not_equal:
+	case op_greater_than:
+	case op_greater_than_equal:
+	case op_minus:
+	case op_bang:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Returns whether the instruction has to be kept even if its value
+// isn't used: it changes something or it can fail.
+int ir_has_effects(uint16_t op) {
+	switch (op) {
+	case op_constant:
+	case op_true:
+	case op_false:
+	case op_null:
+	case op_get_builtin:
+	case op_current_closure:
+	case op_get_global:
+	case op_get_free:
+	case ir_param:
+	case ir_phi:
+	case ir_undef:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+// Returns whether the instruction produces a value.
+static inline int has_value(uint16_t op) {
+	return !ir_is_terminator(op) && op != op_set_global && op != op_set_free;
+}
+
+// Returns whether the value is cheaper to compute again at each use
+// than to keep in a local.
+static inline int is_remat(uint16_t op) {
+	switch (op) {
+	case op_constant:
+	case op_true:
+	case op_false:
+	case op_null:
+	case op_get_builtin:
+	case op_current_closure:
+	case ir_undef:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static int is_supported(uint8_t op) {
+	switch (op) {
+	case op_closure:
+	case op_concurrent_call:
+	case op_load_module:
+	case op_bw_xor:
+	case op_bw_not:
+	case op_bw_lshift:
+	case op_bw_rshift:
+	case op_halt:
+		return 0;
+	default:
+		return op < NUM_OPCODES;
+	}
+}
+
+uint32_t ir_add_inst(struct ir_func *f, uint32_t block, uint16_t op, uint32_t nargs) {
+	if (f->ninsts == f->cap) {
+		f->cap = f->cap ? f->cap * 2 : 64;
+		f->insts = realloc(f->insts, sizeof(struct ir_inst) * f->cap);
+	}
+
+	uint32_t id = f->ninsts++;
+	f->insts[id] = (struct ir_inst) {
+		.op = op,
+		.args = nargs ? calloc(nargs, sizeof(uint32_t)) : NULL,
+		.nargs = nargs,
+		.block = block,
+		.slot = -1
+	};
+	append(&f->blocks[block].insts, &f->blocks[block].ninsts, id);
+	return id;
+}
+
+void ir_replace_uses(struct ir_func *f, uint32_t old, uint32_t new) {
+	for (size_t i = 0; i < f->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[i];
+
+		for (uint32_t j = 0; j < ins->nargs; j++) {
+			if (ins->args[j] == old) {
+				ins->args[j] = new;
+			}
+		}
+	}
+}
+
+void ir_dispose(struct ir_func *f) {
+	for (size_t i = 0; i < f->ninsts; i++) {
+		free(f->insts[i].args);
+	}
+	for (size_t i = 0; i < f->nblocks; i++) {
+		free(f->blocks[i].insts);
+		free(f->blocks[i].preds);
+	}
+	free(f->insts);
+	free(f->blocks);
+	free(f->order);
+	free(f);
+}
+
+// Numbers the blocks reachable from the entry in reverse postorder.
+static void ir_order(struct ir_func *f) {
+	free(f->order);
+	uint32_t *stack = malloc(sizeof(uint32_t) * f->nblocks);
+	int *next = calloc(f->nblocks, sizeof(int));
+	uint8_t *seen = calloc(f->nblocks, 1);
+	uint32_t *post = malloc(sizeof(uint32_t) * f->nblocks);
+	size_t sp = 0, npost = 0;
+
+	stack[sp++] = 0;
+	seen[0] = 1;
+	while (sp > 0) {
+		uint32_t b = stack[sp-1];
+
+		if (next[b] < f->blocks[b].nsuccs) {
+			uint32_t s = f->blocks[b].succs[next[b]++];
+			if (!seen[s]) {
+				seen[s] = 1;
+				stack[sp++] = s;
+			}
+		} else {
+			post[npost++] = b;
+			sp--;
+		}
+	}
+
+	f->order = malloc(sizeof(uint32_t) * npost);
+	f->norder = npost;
+	for (size_t i = 0; i < f->nblocks; i++) {
+		f->blocks[i].rpo = -1;
+	}
+	for (size_t i = 0; i < npost; i++) {
+		f->order[i] = post[npost-1-i];
+		f->blocks[f->order[i]].rpo = i;
+	}
+
+	free(stack);
+	free(next);
+	free(seen);
+	free(post);
+}
+
+// Splits the bytecode in basic blocks and links them, returning 0 if
+// the bytecode has instructions that can't be lifted.
+static int ir_split_blocks(struct ir_func *f, uint8_t *insts, size_t len, uint32_t *block_of) {
+	uint8_t *leader = calloc(len + 1, 1);
+	uint8_t *boundary = calloc(len + 1, 1);
+	int ok = 1;
+
+	leader[0] = 1;
+	for (size_t i = 0; i < len; i += instruction_len(insts[i])) {
+		uint8_t op = insts[i];
+		size_t next = i + instruction_len(op);
+
+		boundary[i] = 1;
+		if (!is_supported(op) || next > len) {
+			ok = 0;
+			goto done;
+		}
+		switch (op) {
+		case op_jump:
+		case op_jump_not_truthy: {
+			size_t target = read_uint16(&insts[i+1]);
+			if (target >= len) {
+				ok = 0;
+				goto done;
+			}
+			leader[target] = 1;
+			leader[next] = 1;
+			break;
+		}
+		case op_return:
+		case op_return_value:
+		case op_tail_call:
+			leader[next] = 1;
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		if (leader[i] && !boundary[i]) {
+			ok = 0;
+			goto done;
+		}
+		if (leader[i]) {
+			block_of[i] = f->nblocks;
+			f->blocks = realloc(f->blocks, sizeof(struct ir_block) * (f->nblocks + 1));
+			f->blocks[f->nblocks++] = (struct ir_block) {.start = i, .idom = IR_NONE};
+		}
+	}
+
+	for (size_t b = 0; b < f->nblocks; b++) {
+		struct ir_block *blk = &f->blocks[b];
+		size_t end = b + 1 < f->nblocks ? f->blocks[b+1].start : len;
+		size_t last = blk->start;
+
+		for (size_t i = blk->start; i < end; i += instruction_len(insts[i])) {
+			last = i;
+		}
+
+		switch (insts[last]) {
+		case op_jump:
+			blk->succs[blk->nsuccs++] = block_of[read_uint16(&insts[last+1])];
+			break;
+		case op_jump_not_truthy:
+			// Both edges to the same block would need to be told apart.
+			if (b + 1 == f->nblocks || block_of[read_uint16(&insts[last+1])] == b + 1) {
+				ok = 0;
+				goto done;
+			}
+			blk->succs[blk->nsuccs++] = block_of[read_uint16(&insts[last+1])];
+			blk->succs[blk->nsuccs++] = b + 1;
+			break;
+		case op_return:
+		case op_return_value:
+		case op_tail_call:
+			break;
+		default:
+			if (b + 1 == f->nblocks) {
+				ok = 0;
+				goto done;
+			}
+			blk->succs[blk->nsuccs++] = b + 1;
+		}
+	}
+
+	ir_order(f);
+	for (size_t i = 0; i < f->norder; i++) {
+		struct ir_block *blk = &f->blocks[f->order[i]];
+
+		for (int j = 0; j < blk->nsuccs; j++) {
+			struct ir_block *s = &f->blocks[blk->succs[j]];
+			append(&s->preds, &s->npreds, f->order[i]);
+		}
+	}
+	// The entry block can't be a merge point since nothing would
+	// flow into its phis from outside.
+	if (f->blocks[0].npreds > 0) {
+		ok = 0;
+	}
+
+done:
+	free(leader);
+	free(boundary);
+	return ok;
+}
+
+// Simulates the block's instructions on the abstract stack and locals,
+// adding the instructions that compute values to the block.
+static int ir_lift_block(struct ir_func *f, uint32_t b, uint8_t *insts, size_t end, uint32_t *locals, uint32_t *stack, int *height) {
+	struct ir_block *blk = &f->blocks[b];
+	int sp = *height;
+
+	for (size_t i = blk->start; i < end; i += instruction_len(insts[i])) {
+		uint8_t op = insts[i];
+		uint32_t imm[2] = {0};
+		int npop = 0;
+		int push = 1;
+
+		struct definition def = definitions[op];
+		size_t off = i + 1;
+		for (int j = 0; j < def.noperands; j++) {
+			imm[j] = def.opwidths[j] == 2 ? read_uint16(&insts[off]) : read_uint8(&insts[off]);
+			off += def.opwidths[j];
+		}
+
+		switch (op) {
+		case op_get_local:
+			stack[sp++] = locals[imm[0]];
+			continue;
+		case op_set_local:
+			if (sp < 1) return 0;
+			locals[imm[0]] = stack[sp-1];
+			continue;
+		case op_pop:
+			if (sp < 1) return 0;
+			sp--;
+			continue;
+
+		case op_jump:
+		case op_return:
+			push = 0;
+			break;
+		case op_set_global:
+		case op_set_free:
+			// The value stays on the stack.
+			if (sp < 1) return 0;
+			uint32_t id = ir_add_inst(f, b, op, 1);
+			f->insts[id].imm[0] = imm[0];
+			f->insts[id].offset = i;
+			f->insts[id].args[0] = stack[sp-1];
+			continue;
+
+		case op_jump_not_truthy:
+		case op_return_value:
+			npop = 1;
+			push = 0;
+			break;
+		case op_tail_call:
+			npop = imm[0] + 1;
+			push = 0;
+			break;
+		case op_call:
+			npop = imm[0] + 1;
+			break;
+		case op_call_builtin:
+			npop = imm[1];
+			break;
+		case op_list:
+		case op_map:
+		case op_interpolate:
+			npop = op == op_interpolate ? imm[1] : imm[0];
+			break;
+		case op_define:
+			npop = 3;
+			break;
+		case op_minus:
+		case op_bang:
+			npop = 1;
+			break;
+		case op_constant:
+		case op_true:
+		case op_false:
+		case op_null:
+		case op_current_closure:
+		case op_get_global:
+		case op_get_builtin:
+		case op_get_free:
+			break;
+		default:
+			npop = 2;
+		}
+
+		if (sp < npop) {
+			return 0;
+		}
+		uint32_t id = ir_add_inst(f, b, op, npop);
+		struct ir_inst *ins = &f->insts[id];
+		ins->imm[0] = imm[0];
+		ins->imm[1] = imm[1];
+		ins->offset = i;
+		sp -= npop;
+		memcpy(ins->args, &stack[sp], sizeof(uint32_t) * npop);
+		if (push) {
+			stack[sp++] = id;
+		}
+	}
+
+	*height = sp;
+	return 1;
+}
+
+// Lifts the bytecode of a function to SSA form, returning NULL if it
+// can't. Blocks are lifted in reverse postorder: a block with a single
+// predecessor starts from the values the predecessor ended with, while
+// the others start with a phi for every local and stack slot. The phis
+// that turn out to merge the same value are removed by
+// ir_copy_propagate.
+struct ir_func *ir_build(uint8_t *insts, size_t len, int num_locals, int num_params) {
+	struct ir_func *f = calloc(1, sizeof(struct ir_func));
+	f->num_locals = num_locals;
+	f->num_params = num_params;
+
+	uint32_t *block_of = malloc(sizeof(uint32_t) * (len + 1));
+	int ok = len > 0 && ir_split_blocks(f, insts, len, block_of);
+	free(block_of);
+	if (!ok) {
+		ir_dispose(f);
+		return NULL;
+	}
+
+	size_t depth = max_stack_depth(insts, len);
+	size_t nvars = num_locals + depth;
+	uint32_t **out = calloc(f->nblocks, sizeof(uint32_t *));
+	int *heights = calloc(f->nblocks, sizeof(int));
+	uint32_t *state = malloc(sizeof(uint32_t) * (nvars + 1));
+
+	for (size_t i = 0; i < f->norder && ok; i++) {
+		uint32_t b = f->order[i];
+		struct ir_block *blk = &f->blocks[b];
+		size_t end = b + 1 < f->nblocks ? f->blocks[b+1].start : len;
+		int height = 0;
+
+		if (b == 0) {
+			uint32_t undef = ir_add_inst(f, b, ir_undef, 0);
+			for (int l = 0; l < num_locals; l++) {
+				state[l] = undef;
+			}
+			for (int p = 0; p < num_params; p++) {
+				state[p] = ir_add_inst(f, b, ir_param, 0);
+				f->insts[state[p]].imm[0] = p;
+			}
+		} else if (blk->npreds == 1) {
+			uint32_t p = blk->preds[0];
+			height = heights[p];
+			memcpy(state, out[p], sizeof(uint32_t) * (num_locals + height));
+		} else {
+			// Some predecessor comes earlier in reverse postorder and
+			// tells the height, the others are checked below.
+			for (size_t j = 0; j < blk->npreds; j++) {
+				if (f->blocks[blk->preds[j]].rpo < blk->rpo) {
+					height = heights[blk->preds[j]];
+					break;
+				}
+			}
+			for (int v = 0; v < num_locals + height; v++) {
+				state[v] = ir_add_inst(f, b, ir_phi, blk->npreds);
+				f->insts[state[v]].imm[0] = v;
+				f->insts[state[v]].imm[1] = v >= num_locals;
+			}
+		}
+
+		ok = ir_lift_block(f, b, insts, end, state, &state[num_locals], &height);
+		heights[b] = height;
+		out[b] = malloc(sizeof(uint32_t) * (num_locals + height + 1));
+		memcpy(out[b], state, sizeof(uint32_t) * (num_locals + height));
+	}
+
+	// Fill in the phis with the values the predecessors end with.
+	for (size_t i = 0; i < f->norder && ok; i++) {
+		struct ir_block *blk = &f->blocks[f->order[i]];
+
+		for (size_t k = 0; k < blk->ninsts; k++) {
+			struct ir_inst *phi = &f->insts[blk->insts[k]];
+			if (phi->op != ir_phi) {
+				break;
+			}
+			for (size_t j = 0; j < blk->npreds; j++) {
+				uint32_t p = blk->preds[j];
+				if (phi->imm[0] >= num_locals + heights[p]) {
+					ok = 0;
+					break;
+				}
+				phi->args[j] = out[p][phi->imm[0]];
+			}
+		}
+		// All the predecessors have to agree on the stack height.
+		for (size_t j = 0; j < blk->npreds && ok && f->order[i] != 0; j++) {
+			uint32_t p0 = blk->preds[0], p = blk->preds[j];
+			if (heights[p] != heights[p0]) {
+				ok = 0;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < f->nblocks; i++) {
+		free(out[i]);
+	}
+	free(out);
+	free(heights);
+	free(state);
+
+	if (!ok) {
+		ir_dispose(f);
+		return NULL;
+	}
+	ir_dominators(f);
+	return f;
+}
+
+static uint32_t intersect(struct ir_func *f, uint32_t a, uint32_t b) {
+	while (a != b) {
+		while (f->blocks[a].rpo > f->blocks[b].rpo) a = f->blocks[a].idom;
+		while (f->blocks[b].rpo > f->blocks[a].rpo) b = f->blocks[b].idom;
+	}
+	return a;
+}
+
+// Computes the immediate dominators with the algorithm of Cooper,
+// Harvey and Kennedy.
+void ir_dominators(struct ir_func *f) {
+	int changed = 1;
+
+	f->blocks[0].idom = 0;
+	while (changed) {
+		changed = 0;
+
+		for (size_t i = 1; i < f->norder; i++) {
+			struct ir_block *blk = &f->blocks[f->order[i]];
+			uint32_t idom = IR_NONE;
+
+			for (size_t j = 0; j < blk->npreds; j++) {
+				uint32_t p = blk->preds[j];
+				if (f->blocks[p].idom == IR_NONE) {
+					continue;
+				}
+				idom = idom == IR_NONE ? p : intersect(f, p, idom);
+			}
+			if (blk->idom != idom) {
+				blk->idom = idom;
+				changed = 1;
+			}
+		}
+	}
+}
+
+int ir_dominates(struct ir_func *f, uint32_t a, uint32_t b) {
+	for (;;) {
+		if (a == b) {
+			return 1;
+		}
+		if (b == 0) {
+			return 0;
+		}
+		b = f->blocks[b].idom;
+	}
+}
+
+// Orders the blocks and computes the dominators again once the control
+// flow changed. The predecessors have to be up to date.
+void ir_update_cfg(struct ir_func *f) {
+	ir_order(f);
+	for (size_t i = 0; i < f->nblocks; i++) {
+		f->blocks[i].idom = IR_NONE;
+	}
+	ir_dominators(f);
+}
+
+// Something to emit in a block: an instruction or the load of a value
+// computed somewhere else.
+struct item {
+	uint32_t id;
+	uint8_t load;
+};
+
+struct schedule {
+	struct item *items;
+	size_t len;
+	int spill; // the stack phis are stored to locals when entering the block
+	int failed;
+};
+
+struct pending {
+	uint32_t id;
+	size_t start; // first item emitted for the value
+	int entry; // on the stack when entering the block
+};
+
+struct scheduler {
+	struct ir_func *f;
+	uint32_t b;
+	struct schedule s;
+	struct pending *pending;
+	size_t npending;
+};
+
+struct patch {
+	size_t at;
+	uint32_t target; // block, or trampoline past the blocks
+};
+
+struct lowering {
+	uint8_t *code;
+	size_t len;
+	struct patch *patches;
+	size_t npatches;
+	int failed; // a value was loaded without having a local
+};
+
+static inline void insert_item(struct schedule *s, size_t at, struct item it) {
+	s->items = realloc(s->items, sizeof(struct item) * (s->len + 1));
+	memmove(&s->items[at+1], &s->items[at], sizeof(struct item) * (s->len - at));
+	s->items[at] = it;
+	s->len++;
+}
+
+// Returns whether the phi merges a stack slot rather than a local. The
+// predecessors leave its value on the stack like the compiler does for
+// the value of an if.
+static inline int is_stack_phi(struct ir_func *f, struct ir_inst *ins) {
+	return ins->op == ir_phi && !ins->dead && ins->imm[1];
+}
+
+// Counts the live stack phis of the block and collects them, or what
+// they merge from the predecessor unless it's IR_NONE.
+static size_t stack_phis(struct ir_func *f, uint32_t b, uint32_t from, uint32_t *out) {
+	struct ir_block *blk = &f->blocks[b];
+	size_t pred = 0, n = 0;
+
+	while (from != IR_NONE && blk->preds[pred] != from) pred++;
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[blk->insts[i]];
+
+		if (ins->op != ir_phi) break;
+		if (is_stack_phi(f, ins) && out != NULL) {
+			out[n] = from == IR_NONE ? blk->insts[i] : ins->args[pred];
+		}
+		n += is_stack_phi(f, ins);
+	}
+	return n;
+}
+
+// Returns whether the value is available from a local or by computing
+// it again before the given item of the block's schedule.
+static int loadable_at(struct scheduler *sc, uint32_t v, size_t at) {
+	struct ir_inst *ins = &sc->f->insts[v];
+
+	if (ins->op == ir_phi) {
+		return !is_stack_phi(sc->f, ins) || ins->block != sc->b;
+	}
+	if (ins->block != sc->b || ins->op == ir_param || is_remat(ins->op)) {
+		return 1;
+	}
+	for (size_t i = 0; i < at; i++) {
+		if (!sc->s.items[i].load && sc->s.items[i].id == v) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Returns whether the value can be left on the stack by its definition
+// until its only use.
+static inline int stackable(struct ir_inst *ins) {
+	return has_value(ins->op) && ins->nuses == 1 && ins->op != ir_phi && ins->op != ir_param && ins->op != ir_undef;
+}
+
+// Gets the arguments on the stack for something taking them in order.
+// The arguments that are on top of the stack in that order stay there,
+// which is how the compiler emitted them in the first place, and the
+// others are loaded. The loads of the arguments that come before a
+// stacked one are moved before the code computing it. Returns the first
+// item emitted for the arguments.
+static size_t consume(struct scheduler *sc, uint32_t *args, uint32_t n) {
+	struct pending *pending = sc->pending;
+	size_t *load_at = malloc(sizeof(size_t) * (n + 1));
+	int *stacked = calloc(n + 1, sizeof(int));
+	uint32_t *pargs = malloc(sizeof(uint32_t) * (n + 1));
+
+	// The pending arguments, of which the longest tail found on top of
+	// the stack in order stays there.
+	size_t m = 0;
+	for (uint32_t j = 0; j < n; j++) {
+		for (size_t p = 0; p < sc->npending; p++) {
+			if (pending[p].id == args[j]) pargs[m++] = j;
+		}
+	}
+	size_t t = m;
+	while (t > 0) {
+		int match = 1;
+		for (size_t q = 0; q < t && match; q++) {
+			match = pending[sc->npending-t+q].id == args[pargs[m-t+q]];
+		}
+		if (match) break;
+		t--;
+	}
+
+	// Each load goes before the code of the next stacked argument, or
+	// at the end.
+	int ok = 1;
+	for (size_t q = m - t; q < m; q++) {
+		stacked[pargs[q]] = 1;
+	}
+	size_t next = sc->s.len;
+	for (int j = n - 1; j >= 0; j--) {
+		if (stacked[j]) {
+			size_t q = sc->npending - t;
+			while (pending[q].id != args[j]) q++;
+			// Nothing can be loaded below what was there on entry.
+			next = pending[q].entry ? SIZE_MAX : pending[q].start;
+		} else {
+			load_at[j] = next;
+			ok &= next != SIZE_MAX && loadable_at(sc, args[j], next);
+		}
+	}
+	if (!ok) {
+		t = 0;
+		for (uint32_t j = 0; j < n; j++) {
+			stacked[j] = 0;
+			load_at[j] = sc->s.len;
+		}
+	}
+
+	size_t start = sc->s.len;
+	if (n > 0) {
+		start = stacked[0] ? pending[sc->npending-t].start : load_at[0];
+	}
+	for (int j = n - 1; j >= 0; j--) {
+		if (stacked[j]) {
+			sc->f->insts[args[j]].stacked = 1;
+		} else {
+			insert_item(&sc->s, load_at[j], (struct item) {.id = args[j], .load = 1});
+		}
+	}
+
+	// The stacked arguments are consumed and the other pending ones will
+	// get a local.
+	sc->npending -= t;
+	size_t kept = 0;
+	for (size_t p = 0; p < sc->npending; p++) {
+		int used = 0;
+		for (size_t q = 0; q < m; q++) {
+			used |= pending[p].id == args[pargs[q]];
+		}
+		if (!used) pending[kept++] = pending[p];
+	}
+	sc->npending = kept;
+
+	free(load_at);
+	free(stacked);
+	free(pargs);
+	return start;
+}
+
+// Leaves the values of the successor's stack phis on the stack.
+static void consume_edge(struct scheduler *sc, uint32_t to) {
+	uint32_t *args = malloc(sizeof(uint32_t) * (sc->f->blocks[to].ninsts + 1));
+	size_t n = stack_phis(sc->f, to, sc->b, args);
+
+	consume(sc, args, n);
+	free(args);
+}
+
+// Schedules the block's instructions in order, deciding which values are
+// left on the stack from their definition to their only use instead of
+// getting a local. The block's stack phis are taken from the stack like
+// any other value if keep_phis is set, and stored to locals otherwise.
+static struct schedule ir_schedule_block(struct ir_func *f, uint32_t b, int keep_phis) {
+	struct ir_block *blk = &f->blocks[b];
+	struct scheduler sc = {.f = f, .b = b};
+	int terminated = 0;
+
+	sc.pending = malloc(sizeof(struct pending) * (blk->ninsts + 1));
+	if (keep_phis) {
+		uint32_t *phis = malloc(sizeof(uint32_t) * (blk->ninsts + 1));
+		size_t n = stack_phis(f, b, IR_NONE, phis);
+
+		// Only a value used once can stay on the stack, the others need
+		// a local to be loaded from at each use.
+		for (size_t i = 0; i < n; i++) {
+			keep_phis &= f->insts[phis[i]].nuses == 1;
+		}
+		for (size_t i = 0; i < n && keep_phis; i++) {
+			sc.pending[sc.npending++] = (struct pending) {.id = phis[i], .start = 0, .entry = 1};
+		}
+		free(phis);
+	}
+	sc.s.spill = !keep_phis;
+
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		uint32_t id = blk->insts[i];
+		struct ir_inst *ins = &f->insts[id];
+		if (ins->dead || ins->op == ir_phi || ins->op == ir_param || ins->op == ir_undef) continue;
+
+		if (ins->op == op_jump) {
+			consume_edge(&sc, blk->succs[0]);
+		} else if (ins->op == op_jump_not_truthy) {
+			// Both ways would have to leave the same values.
+			sc.s.failed |= stack_phis(f, blk->succs[0], IR_NONE, NULL) || stack_phis(f, blk->succs[1], IR_NONE, NULL);
+		}
+
+		size_t start = consume(&sc, ins->args, ins->nargs);
+		insert_item(&sc.s, sc.s.len, (struct item) {.id = id});
+		if (stackable(ins)) {
+			sc.pending[sc.npending++] = (struct pending) {.id = id, .start = start};
+		}
+		terminated = ir_is_terminator(ins->op);
+	}
+	if (!terminated && blk->nsuccs == 1) {
+		consume_edge(&sc, blk->succs[0]);
+	}
+
+	// The stack phis that couldn't be left on the stack are stored.
+	for (size_t i = 0; i < blk->ninsts && keep_phis && !sc.s.failed; i++) {
+		struct ir_inst *ins = &f->insts[blk->insts[i]];
+		if (is_stack_phi(f, ins) && !ins->stacked) {
+			for (size_t j = 0; j < f->ninsts; j++) {
+				if (f->insts[j].block == b) f->insts[j].stacked = 0;
+			}
+			free(sc.s.items);
+			free(sc.pending);
+			return ir_schedule_block(f, b, 0);
+		}
+	}
+
+	free(sc.pending);
+	return sc.s;
+}
+
+static void emit_jump(struct lowering *l, enum opcode op, uint32_t target) {
+	l->patches = realloc(l->patches, sizeof(struct patch) * (l->npatches + 1));
+	l->patches[l->npatches++] = (struct patch) {.at = l->len, .target = target};
+	l->len = make_bcode(&l->code, l->len, op, 0);
+}
+
+// Pushes the value on the stack, from its local or computing it again.
+static void emit_load(struct ir_func *f, struct lowering *l, uint32_t v) {
+	struct ir_inst *ins = &f->insts[v];
+
+	switch (ins->op) {
+	case ir_undef:
+		l->len = make_bcode(&l->code, l->len, op_null);
+		break;
+	case ir_param:
+		l->len = make_bcode(&l->code, l->len, op_get_local, ins->imm[0]);
+		break;
+	default:
+		if (is_remat(ins->op)) {
+			l->len = make_bcode(&l->code, l->len, ins->op, ins->imm[0], ins->imm[1]);
+		} else {
+			l->failed |= ins->slot == -1;
+			l->len = make_bcode(&l->code, l->len, op_get_local, ins->slot);
+		}
+	}
+}
+
+// Assigns the successor's phis of locals as a parallel copy: the values
+// are all pushed first and then stored in reverse.
+static void emit_phi_moves(struct ir_func *f, struct lowering *l, uint32_t from, uint32_t to) {
+	struct ir_block *blk = &f->blocks[to];
+	uint32_t *moved = malloc(sizeof(uint32_t) * (blk->ninsts + 1));
+	size_t nmoved = 0;
+	size_t pred = 0;
+
+	while (blk->preds[pred] != from) pred++;
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		uint32_t p = blk->insts[i];
+		struct ir_inst *phi = &f->insts[p];
+
+		if (phi->op != ir_phi) break;
+		if (phi->dead || is_stack_phi(f, phi) || phi->args[pred] == p) continue;
+		emit_load(f, l, phi->args[pred]);
+		moved[nmoved++] = p;
+	}
+	while (nmoved > 0) {
+		l->len = make_bcode(&l->code, l->len, op_set_local, f->insts[moved[--nmoved]].slot);
+		l->len = make_bcode(&l->code, l->len, op_pop);
+	}
+	free(moved);
+}
+
+static inline int has_phis(struct ir_func *f, uint32_t b) {
+	struct ir_block *blk = &f->blocks[b];
+
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[blk->insts[i]];
+		if (ins->op != ir_phi) return 0;
+		if (!ins->dead && !is_stack_phi(f, ins)) return 1;
+	}
+	return 0;
+}
+
+// Goes from the end of a block to its successor: the phi moves for the
+// edge and the jump unless the successor is the next block.
+static void emit_edge(struct ir_func *f, struct lowering *l, uint32_t from, uint32_t to, uint32_t next) {
+	emit_phi_moves(f, l, from, to);
+	if (to != next) {
+		emit_jump(l, op_jump, to);
+	}
+}
+
+static void count_uses(struct ir_func *f) {
+	for (size_t i = 0; i < f->ninsts; i++) {
+		f->insts[i].nuses = 0;
+	}
+	for (size_t i = 0; i < f->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[i];
+		for (uint32_t j = 0; j < ins->nargs && !ins->dead; j++) {
+			f->insts[ins->args[j]].nuses++;
+		}
+	}
+}
+
+// Lowers the SSA form back to bytecode. The values that can't stay on
+// the stack get a local of their own past the parameters, and the phis
+// of locals are assigned at the end of the predecessors. The
+// conditional jumps into blocks with such phis go through a trampoline
+// at the end of the function doing the moves. Returns NULL if the values
+// need more locals than the bytecode can address, if a conditional
+// jump would have to leave values on the stack, or if a value left on
+// the stack would have to be loaded again.
+uint8_t *ir_lower(struct ir_func *f, size_t *len, int *num_locals) {
+	struct schedule *sched = calloc(f->nblocks, sizeof(struct schedule));
+	int nslots = f->num_params;
+
+	count_uses(f);
+	for (size_t i = 0; i < f->ninsts; i++) {
+		f->insts[i].stacked = 0;
+		f->insts[i].slot = -1;
+	}
+	int failed = 0;
+	for (size_t o = 0; o < f->norder; o++) {
+		sched[f->order[o]] = ir_schedule_block(f, f->order[o], 1);
+		failed |= sched[f->order[o]].failed;
+	}
+	for (size_t i = 0; i < f->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[i];
+		if (ins->dead || !has_value(ins->op) || is_remat(ins->op) || ins->op == ir_param) continue;
+		if (!ins->stacked && (ins->op == ir_phi || ins->nuses > 0)) {
+			ins->slot = nslots++;
+		}
+	}
+
+	struct lowering l = {0};
+	uint32_t *offsets = malloc(sizeof(uint32_t) * (f->nblocks + f->norder + 1));
+	uint32_t *tramp_from = malloc(sizeof(uint32_t) * (f->norder + 1));
+	uint32_t *tramp_to = malloc(sizeof(uint32_t) * (f->norder + 1));
+	size_t ntramps = 0;
+
+	// The blocks are laid out in reverse postorder, which is the
+	// bytecode order for what the compiler emits and puts inlined code
+	// between the call and what follows it.
+	uint32_t *layout = f->order;
+	size_t nlayout = f->norder;
+
+	for (size_t k = 0; k < nlayout; k++) {
+		uint32_t b = layout[k];
+		uint32_t next = k + 1 < nlayout ? layout[k+1] : IR_NONE;
+		struct ir_block *blk = &f->blocks[b];
+		struct schedule s = sched[b];
+		int terminated = 0;
+
+		offsets[b] = l.len;
+		if (s.spill) {
+			uint32_t *phis = malloc(sizeof(uint32_t) * (blk->ninsts + 1));
+			size_t n = stack_phis(f, b, IR_NONE, phis);
+
+			while (n > 0) {
+				l.len = make_bcode(&l.code, l.len, op_set_local, f->insts[phis[--n]].slot);
+				l.len = make_bcode(&l.code, l.len, op_pop);
+			}
+			free(phis);
+		}
+		for (size_t i = 0; i < s.len; i++) {
+			struct ir_inst *ins = &f->insts[s.items[i].id];
+
+			if (s.items[i].load) {
+				emit_load(f, &l, s.items[i].id);
+				continue;
+			}
+			if (is_remat(ins->op) && !ins->stacked) {
+				continue;
+			}
+
+			switch (ins->op) {
+			case op_jump:
+				emit_edge(f, &l, b, blk->succs[0], next);
+				terminated = 1;
+				break;
+			case op_jump_not_truthy:
+				if (has_phis(f, blk->succs[0])) {
+					tramp_from[ntramps] = b;
+					tramp_to[ntramps] = blk->succs[0];
+					emit_jump(&l, op_jump_not_truthy, f->nblocks + ntramps++);
+				} else {
+					emit_jump(&l, op_jump_not_truthy, blk->succs[0]);
+				}
+				emit_edge(f, &l, b, blk->succs[1], next);
+				terminated = 1;
+				break;
+			case op_set_global:
+			case op_set_free:
+				l.len = make_bcode(&l.code, l.len, ins->op, ins->imm[0]);
+				l.len = make_bcode(&l.code, l.len, op_pop);
+				break;
+			default:
+				l.len = make_bcode(&l.code, l.len, ins->op, ins->imm[0], ins->imm[1]);
+				if (ins->slot != -1) {
+					l.len = make_bcode(&l.code, l.len, op_set_local, ins->slot);
+					l.len = make_bcode(&l.code, l.len, op_pop);
+				} else if (has_value(ins->op) && ins->nuses == 0) {
+					l.len = make_bcode(&l.code, l.len, op_pop);
+				}
+				terminated = ir_is_terminator(ins->op);
+			}
+		}
+		if (!terminated) {
+			emit_edge(f, &l, b, blk->succs[0], next);
+		}
+	}
+
+	for (size_t t = 0; t < ntramps; t++) {
+		offsets[f->nblocks + t] = l.len;
+		emit_edge(f, &l, tramp_from[t], tramp_to[t], IR_NONE);
+	}
+	for (size_t i = 0; i < l.npatches; i++) {
+		uint32_t target = offsets[l.patches[i].target];
+		l.code[l.patches[i].at+1] = target >> 8;
+		l.code[l.patches[i].at+2] = target & 0xff;
+	}
+
+	for (size_t b = 0; b < f->nblocks; b++) {
+		free(sched[b].items);
+	}
+	free(sched);
+	free(offsets);
+	free(tramp_from);
+	free(tramp_to);
+	free(l.patches);
+
+	if (failed || l.failed || nslots > 256 || l.len > UINT16_MAX) {
+		free(l.code);
+		return NULL;
+	}
+	*len = l.len;
+	*num_locals = nslots;
+	return l.code;
+}
+
+// Optimizes the bytecode of a function going through the SSA form.
+// The bytecode is left as is if the function can't be lifted or if the
+// result is longer without any call inlined or anything hoisted out of
+// a loop to make up for it.
+int ir_optimize(uint8_t **insts, size_t *len, int *num_locals, int num_params, struct ir_inliner *inl) {
+	struct ir_func *f = ir_build(*insts, *len, *num_locals, num_params);
+	if (f == NULL) {
+		return 0;
+	}
+
+	if (inl != NULL) {
+		ir_inline(f, inl);
+	}
+	ir_copy_propagate(f);
+	ir_merge_blocks(f);
+	ir_cse(f);
+	ir_licm(f);
+	ir_dce(f);
+
+	size_t newlen;
+	int newlocals;
+	uint8_t *code = ir_lower(f, &newlen, &newlocals);
+	int grown = f->nhoisted > 0 || f->ninlined > 0;
+	ir_dispose(f);
+
+	if (code == NULL || (newlen > *len && !grown)) {
+		free(code);
+		return 0;
+	}
+	free(*insts);
+	*insts = code;
+	*len = newlen;
+	*num_locals = newlocals;
+	return 1;
+}
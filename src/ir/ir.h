@@ -0,0 +1,113 @@
+#ifndef IR_H_
+#define IR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../code/code.h"
+
+// SSA form of a function's bytecode.
+//
+// The bytecode is lifted by simulating the value stack, so the locals
+// and the stack slots become virtual registers: an instruction's
+// arguments are the ids of the instructions that computed them, and the
+// values that merge at the start of a block are phi nodes. Loads and
+// stores of locals and pops don't appear in the IR at all.
+//
+// The IR uses the bytecode opcodes for the operations and adds the
+// following ones.
+enum ir_op {
+	ir_param = NUM_OPCODES, // function parameter, imm[0] is its index
+	ir_phi,                 // one argument per predecessor of the block,
+	                        // imm[0] is the local or stack slot merged and
+	                        // imm[1] whether it's a stack slot
+	ir_undef                // local read before it's assigned
+};
+
+#define IR_NONE UINT32_MAX
+
+// Longest bytecode of a function inlined at its call sites by default.
+#define IR_INLINE_THRESHOLD 32
+
+struct ir_inst {
+	uint16_t op;
+	uint8_t dead;
+	uint8_t stacked; // left on the stack until its use once lowered
+	uint32_t imm[2];
+	uint32_t *args;
+	uint32_t nargs;
+	uint32_t block;
+	uint32_t nuses;
+	int32_t slot; // local holding the value once lowered, -1 if none
+	uint32_t offset; // of the bytecode instruction it comes from
+};
+
+struct ir_block {
+	uint32_t start; // bytecode offset
+	uint32_t *insts; // phis first, then the body and the terminator if any
+	size_t ninsts;
+	uint32_t *preds;
+	size_t npreds;
+	// Blocks without a terminator fall through to their only successor.
+	// op_jump_not_truthy goes to the first successor if the condition
+	// is false and to the second otherwise.
+	uint32_t succs[2];
+	int nsuccs;
+	uint32_t idom;
+	int rpo; // position in reverse postorder, -1 if unreachable
+};
+
+struct ir_func {
+	struct ir_inst *insts;
+	size_t ninsts;
+	size_t cap;
+	struct ir_block *blocks;
+	size_t nblocks;
+	uint32_t *order; // reachable blocks in reverse postorder
+	size_t norder;
+	int num_params;
+	int num_locals;
+
+	// What the passes did.
+	size_t ncopies;
+	size_t ncse;
+	size_t ndead;
+	size_t nhoisted;
+	size_t ninlined;
+};
+
+struct object;
+
+// Inlining of the calls to constant closures, the functions that don't
+// capture anything and refer to themselves only through a global or
+// through the constant it's folded to.
+struct function;
+
+struct ir_inliner {
+	struct object **consts;
+	struct function *self; // being optimized, never inlined in itself
+	size_t threshold; // longest bytecode inlined, 0 disables inlining
+	int report; // whether to print the inlined call sites
+};
+
+struct ir_func *ir_build(uint8_t *insts, size_t len, int num_locals, int num_params);
+void ir_update_cfg(struct ir_func *f);
+void ir_dominators(struct ir_func *f);
+int ir_dominates(struct ir_func *f, uint32_t a, uint32_t b);
+void ir_replace_uses(struct ir_func *f, uint32_t old, uint32_t new);
+uint32_t ir_add_inst(struct ir_func *f, uint32_t block, uint16_t op, uint32_t nargs);
+int ir_is_terminator(uint16_t op);
+int ir_is_pure(uint16_t op);
+int ir_has_effects(uint16_t op);
+uint8_t *ir_lower(struct ir_func *f, size_t *len, int *num_locals);
+void ir_dispose(struct ir_func *f);
+
+void ir_copy_propagate(struct ir_func *f);
+void ir_merge_blocks(struct ir_func *f);
+void ir_cse(struct ir_func *f);
+void ir_dce(struct ir_func *f);
+void ir_licm(struct ir_func *f);
+void ir_inline(struct ir_func *f, struct ir_inliner *inl);
+
+int ir_optimize(uint8_t **insts, size_t *len, int *num_locals, int num_params, struct ir_inliner *inl);
+
+#endif
@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+// Returns the value the phi always merges besides itself, or IR_NONE if
+// it merges different ones.
+static uint32_t trivial_phi(struct ir_func *f, uint32_t p) {
+	struct ir_inst *phi = &f->insts[p];
+	uint32_t same = IR_NONE;
+
+	for (uint32_t i = 0; i < phi->nargs; i++) {
+		uint32_t v = phi->args[i];
+
+		if (v == p || v == same) {
+			continue;
+		}
+		if (same != IR_NONE) {
+			return IR_NONE;
+		}
+		same = v;
+	}
+	return same;
+}
+
+// Removes the phis that merge a single value, replacing them with it.
+// Since ir_build puts a phi for every local at each merge point most of
+// them are copies. Removing one can make others trivial, so it goes on
+// until nothing changes.
+void ir_copy_propagate(struct ir_func *f) {
+	int changed = 1;
+
+	while (changed) {
+		changed = 0;
+
+		for (size_t i = 0; i < f->ninsts; i++) {
+			struct ir_inst *ins = &f->insts[i];
+			if (ins->dead || ins->op != ir_phi) {
+				continue;
+			}
+
+			uint32_t v = trivial_phi(f, i);
+			if (v != IR_NONE) {
+				ir_replace_uses(f, i, v);
+				ins->dead = 1;
+				f->ncopies++;
+				changed = 1;
+			}
+		}
+	}
+}
+
+// Returns the operation allocating its result on the heap instead of
+// the frame's region.
+static inline uint16_t heap_op(uint16_t op) {
+	switch (op) {
+	case op_add_tmp:
+		return op_add;
+	case op_sub_tmp:
+		return op_sub;
+	default:
+		return op;
+	}
+}
+
+static inline int has_live_phis(struct ir_func *f, struct ir_block *blk) {
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[blk->insts[i]];
+		if (ins->op == ir_phi && !ins->dead) return 1;
+	}
+	return 0;
+}
+
+// Merges the blocks into their only predecessor when it goes nowhere
+// else, like the inlined code and what surrounds it.
+void ir_merge_blocks(struct ir_func *f) {
+	int merged = 0;
+
+	for (size_t o = 0; o < f->norder; o++) {
+		uint32_t b = f->order[o];
+		struct ir_block *blk = &f->blocks[b];
+		if (blk->rpo == -1) {
+			continue;
+		}
+
+		while (blk->nsuccs == 1) {
+			uint32_t s = blk->succs[0];
+			struct ir_block *sblk = &f->blocks[s];
+			if (s == b || s == 0 || sblk->npreds != 1 || has_live_phis(f, sblk)) {
+				break;
+			}
+
+			if (blk->ninsts > 0 && f->insts[blk->insts[blk->ninsts-1]].op == op_jump) {
+				f->insts[blk->insts[--blk->ninsts]].dead = 1;
+			}
+			blk->insts = realloc(blk->insts, sizeof(uint32_t) * (blk->ninsts + sblk->ninsts + 1));
+			for (size_t i = 0; i < sblk->ninsts; i++) {
+				f->insts[sblk->insts[i]].block = b;
+				blk->insts[blk->ninsts++] = sblk->insts[i];
+			}
+
+			blk->nsuccs = sblk->nsuccs;
+			memcpy(blk->succs, sblk->succs, sizeof(blk->succs));
+			for (int i = 0; i < blk->nsuccs; i++) {
+				struct ir_block *next = &f->blocks[blk->succs[i]];
+				for (size_t j = 0; j < next->npreds; j++) {
+					if (next->preds[j] == s) next->preds[j] = b;
+				}
+			}
+			*sblk = (struct ir_block) {.insts = sblk->insts, .preds = sblk->preds, .idom = IR_NONE, .rpo = -1};
+			merged = 1;
+		}
+	}
+	if (merged) {
+		ir_update_cfg(f);
+	}
+}
+
+static inline int same_expr(struct ir_inst *a, struct ir_inst *b) {
+	return heap_op(a->op) == heap_op(b->op) &&
+		a->imm[0] == b->imm[0] &&
+		a->imm[1] == b->imm[1] &&
+		a->nargs == b->nargs &&
+		memcmp(a->args, b->args, sizeof(uint32_t) * a->nargs) == 0;
+}
+
+// Returns whether the instruction a is computed before b on every path.
+static int available(struct ir_func *f, uint32_t a, uint32_t b) {
+	uint32_t ba = f->insts[a].block, bb = f->insts[b].block;
+
+	if (ba != bb) {
+		return ir_dominates(f, ba, bb);
+	}
+	struct ir_block *blk = &f->blocks[ba];
+	for (size_t i = 0; i < blk->ninsts; i++) {
+		if (blk->insts[i] == a) return 1;
+		if (blk->insts[i] == b) return 0;
+	}
+	return 0;
+}
+
+// Replaces the pure instructions computing what an earlier one already
+// computed with its value. The blocks are visited in reverse postorder,
+// so the replaced arguments are already canonical when an instruction
+// is compared. A sum kept in the region replacing one that could escape
+// is moved to the heap.
+void ir_cse(struct ir_func *f) {
+	uint32_t *seen = NULL;
+	size_t nseen = 0;
+
+	for (size_t o = 0; o < f->norder; o++) {
+		struct ir_block *blk = &f->blocks[f->order[o]];
+
+		for (size_t i = 0; i < blk->ninsts; i++) {
+			uint32_t id = blk->insts[i];
+			struct ir_inst *ins = &f->insts[id];
+			if (ins->dead || !ir_is_pure(ins->op)) {
+				continue;
+			}
+
+			int replaced = 0;
+			for (size_t j = 0; j < nseen && !replaced; j++) {
+				struct ir_inst *prev = &f->insts[seen[j]];
+				if (same_expr(prev, ins) && available(f, seen[j], id)) {
+					if (ins->op != prev->op) {
+						prev->op = heap_op(prev->op);
+					}
+					ir_replace_uses(f, id, seen[j]);
+					ins->dead = 1;
+					f->ncse++;
+					replaced = 1;
+				}
+			}
+			if (!replaced) {
+				seen = realloc(seen, sizeof(uint32_t) * (nseen + 1));
+				seen[nseen++] = id;
+			}
+		}
+	}
+	free(seen);
+}
+
+// Removes the instructions whose values aren't used by anything that
+// has to be kept.
+void ir_dce(struct ir_func *f) {
+	uint8_t *live = calloc(f->ninsts, 1);
+	uint32_t *work = malloc(sizeof(uint32_t) * (f->ninsts + 1));
+	size_t nwork = 0;
+
+	for (size_t o = 0; o < f->norder; o++) {
+		struct ir_block *blk = &f->blocks[f->order[o]];
+
+		for (size_t i = 0; i < blk->ninsts; i++) {
+			uint32_t id = blk->insts[i];
+			struct ir_inst *ins = &f->insts[id];
+			if (!ins->dead && (ir_has_effects(ins->op) || ir_is_terminator(ins->op))) {
+				live[id] = 1;
+				work[nwork++] = id;
+			}
+		}
+	}
+	while (nwork > 0) {
+		struct ir_inst *ins = &f->insts[work[--nwork]];
+
+		for (uint32_t i = 0; i < ins->nargs; i++) {
+			uint32_t v = ins->args[i];
+			if (!live[v]) {
+				live[v] = 1;
+				work[nwork++] = v;
+			}
+		}
+	}
+	for (size_t i = 0; i < f->ninsts; i++) {
+		struct ir_inst *ins = &f->insts[i];
+		if (!ins->dead && !live[i] && ins->op != ir_param && ins->op != ir_undef) {
+			ins->dead = 1;
+			f->ndead++;
+		}
+	}
+
+	free(live);
+	free(work);
+}
+
+// Moves the instruction before the terminator of the block.
+static void hoist(struct ir_func *f, uint32_t id, uint32_t to) {
+	struct ir_block *src = &f->blocks[f->insts[id].block];
+	struct ir_block *dst = &f->blocks[to];
+	size_t at = dst->ninsts;
+
+	for (size_t i = 0; i < src->ninsts; i++) {
+		if (src->insts[i] == id) {
+			memmove(&src->insts[i], &src->insts[i+1], sizeof(uint32_t) * (src->ninsts - i - 1));
+			src->ninsts--;
+			break;
+		}
+	}
+	if (at > 0 && ir_is_terminator(f->insts[dst->insts[at-1]].op)) {
+		at--;
+	}
+	dst->insts = realloc(dst->insts, sizeof(uint32_t) * (dst->ninsts + 1));
+	memmove(&dst->insts[at+1], &dst->insts[at], sizeof(uint32_t) * (dst->ninsts - at));
+	dst->insts[at] = id;
+	dst->ninsts++;
+	f->insts[id].block = to;
+}
+
+// Hoists the loop's invariant computations to its preheader, returning
+// how many.
+static size_t licm_loop(struct ir_func *f, uint32_t header, uint8_t *body) {
+	struct ir_block *hdr = &f->blocks[header];
+	uint32_t pre = IR_NONE;
+
+	// The only way in has to come from a block that goes nowhere else.
+	for (size_t i = 0; i < hdr->npreds; i++) {
+		uint32_t p = hdr->preds[i];
+		if (body[p]) {
+			continue;
+		}
+		if (pre != IR_NONE || f->blocks[p].nsuccs != 1) {
+			return 0;
+		}
+		pre = p;
+	}
+	if (pre == IR_NONE) {
+		return 0;
+	}
+
+	size_t hoisted = 0;
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+
+		for (size_t o = 0; o < f->norder; o++) {
+			uint32_t b = f->order[o];
+			if (!body[b]) {
+				continue;
+			}
+
+			// Something that can fail is only hoisted from the blocks that
+			// run on every iteration that leaves the loop.
+			int always = 1;
+			for (size_t e = 0; e < f->norder && always; e++) {
+				struct ir_block *exiting = &f->blocks[f->order[e]];
+				if (!body[f->order[e]]) {
+					continue;
+				}
+				for (int s = 0; s < exiting->nsuccs; s++) {
+					if (!body[exiting->succs[s]] && !ir_dominates(f, b, f->order[e])) {
+						always = 0;
+					}
+				}
+			}
+			if (!always) {
+				continue;
+			}
+
+			struct ir_block *blk = &f->blocks[b];
+			for (size_t i = 0; i < blk->ninsts; i++) {
+				uint32_t id = blk->insts[i];
+				struct ir_inst *ins = &f->insts[id];
+				if (ins->dead || !ir_is_pure(ins->op) || ins->nargs == 0) {
+					continue;
+				}
+
+				int invariant = 1;
+				for (uint32_t j = 0; j < ins->nargs; j++) {
+					invariant &= !body[f->insts[ins->args[j]].block];
+				}
+				if (invariant) {
+					hoist(f, id, pre);
+					hoisted++;
+					changed = 1;
+					i--;
+				}
+			}
+		}
+	}
+	return hoisted;
+}
+
+// Finds the natural loops from their back edges, a jump to a block
+// that dominates the one jumping, and hoists their invariant code.
+void ir_licm(struct ir_func *f) {
+	uint8_t *body = malloc(f->nblocks);
+	uint32_t *work = malloc(sizeof(uint32_t) * (f->nblocks + 1));
+
+	for (size_t o = 0; o < f->norder; o++) {
+		uint32_t header = f->order[o];
+		struct ir_block *hdr = &f->blocks[header];
+		size_t nwork = 0;
+		int loop = 0;
+
+		memset(body, 0, f->nblocks);
+		body[header] = 1;
+		for (size_t i = 0; i < hdr->npreds; i++) {
+			uint32_t p = hdr->preds[i];
+			if (!ir_dominates(f, header, p)) {
+				continue;
+			}
+			loop = 1;
+			if (!body[p]) {
+				body[p] = 1;
+				work[nwork++] = p;
+			}
+		}
+		// Walk back from the back edges up to the header.
+		while (nwork > 0) {
+			struct ir_block *blk = &f->blocks[work[--nwork]];
+
+			for (size_t i = 0; i < blk->npreds; i++) {
+				uint32_t p = blk->preds[i];
+				if (!body[p]) {
+					body[p] = 1;
+					work[nwork++] = p;
+				}
+			}
+		}
+		if (loop) {
+			f->nhoisted += licm_loop(f, header, body);
+		}
+	}
+
+	free(body);
+	free(work);
+}
@@ -6,10 +6,6 @@ static void dispose_boolean_obj(struct object *o) {
 	free(o);
 }
 
-void print_boolean_obj(struct object *o) {
-	puts(o->data.i == 1 ? "true" : "false");
-}
-
 struct object *parse_bool(int b) {
 	return b ? true_obj : false_obj;
 }
@@ -19,7 +15,7 @@ struct object *new_boolean_obj(int b) {
 	o->data.i = b != 0;
 	o->type = obj_boolean;
 	o->dispose = dispose_boolean_obj;
-	o->print = print_boolean_obj;
+	o->print = print_obj;
 
 	return o;
 }
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "obj.h"
+
+static void dispose_builtin_obj(struct object *o) {}
+
+static inline void check_nargs(char *name, size_t nargs, size_t expected) {
+	if (nargs != expected) {
+		printf("%s: wrong number of arguments, expected %lu, got %lu\n", name, expected, nargs);
+		exit(1);
+	}
+}
+
+static inline void unsupported_type_error(char *name, struct object *o) {
+	printf("%s: argument of type %s not supported\n", name, otype_str(o->type));
+	exit(1);
+}
+
+static struct object *len_builtin(struct object **args, size_t nargs) {
+	check_nargs("len", nargs, 1);
+
+	switch (args[0]->type) {
+	case obj_string:
+	case obj_list:
+		return new_integer_obj(args[0]->len);
+	case obj_map:
+		return new_integer_obj(args[0]->data.map->len);
+	default:
+		unsupported_type_error("len", args[0]);
+		return NULL;
+	}
+}
+
+static struct object *println_builtin(struct object **args, size_t nargs) {
+	out_write_objs(args, nargs, 1);
+	return null_obj;
+}
+
+static struct object *print_builtin(struct object **args, size_t nargs) {
+	out_write_objs(args, nargs, 0);
+	return null_obj;
+}
+
+static struct object *string_builtin(struct object **args, size_t nargs) {
+	check_nargs("string", nargs, 1);
+
+	if (args[0]->type == obj_string) {
+		return args[0];
+	}
+
+	struct strbuilder sb = {0};
+	sb_write_obj(&sb, args[0], 0);
+	struct object *s = new_string_obj(sb.data, sb.len);
+	free(sb.data);
+
+	return s;
+}
+
+// Copies the string in a NUL-terminated buffer for the strto* functions.
+static inline char *cstring(struct object *s) {
+	char *buf = malloc(s->len + 1);
+	memcpy(buf, s->data.str, s->len);
+	buf[s->len] = '\0';
+
+	return buf;
+}
+
+static struct object *int_builtin(struct object **args, size_t nargs) {
+	check_nargs("int", nargs, 1);
+
+	switch (args[0]->type) {
+	case obj_integer:
+		return args[0];
+	case obj_float:
+		return new_integer_obj(args[0]->data.f);
+	case obj_boolean:
+		return new_integer_obj(args[0]->data.i != 0);
+	case obj_string: {
+		char *str = cstring(args[0]);
+		char *end = NULL;
+		int64_t i = strtoll(str, &end, 0);
+		int ok = args[0]->len > 0 && *end == '\0';
+		free(str);
+
+		if (!ok) {
+			printf("int: %.*s is not a valid integer\n", (int) args[0]->len, args[0]->data.str);
+			exit(1);
+		}
+		return new_integer_obj(i);
+	}
+	default:
+		unsupported_type_error("int", args[0]);
+		return NULL;
+	}
+}
+
+static struct object *float_builtin(struct object **args, size_t nargs) {
+	check_nargs("float", nargs, 1);
+
+	switch (args[0]->type) {
+	case obj_float:
+		return args[0];
+	case obj_integer:
+		return new_float_obj(args[0]->data.i);
+	case obj_string: {
+		char *str = cstring(args[0]);
+		char *end = NULL;
+		double f = strtod(str, &end);
+		int ok = args[0]->len > 0 && *end == '\0';
+		free(str);
+
+		if (!ok) {
+			printf("float: %.*s is not a valid float\n", (int) args[0]->len, args[0]->data.str);
+			exit(1);
+		}
+		return new_float_obj(f);
+	}
+	default:
+		unsupported_type_error("float", args[0]);
+		return NULL;
+	}
+}
+
+static struct object *append_builtin(struct object **args, size_t nargs) {
+	if (nargs == 0) {
+		puts("append: wrong number of arguments, expected at least 1, got 0");
+		exit(1);
+	}
+	if (args[0]->type != obj_list) {
+		unsupported_type_error("append", args[0]);
+	}
+
+	return list_append(args[0], &args[1], nargs - 1);
+}
+
+static struct object *type_builtin(struct object **args, size_t nargs) {
+	check_nargs("type", nargs, 1);
+
+	char *type = otype_str(args[0]->type);
+	return new_string_obj(type, strlen(type));
+}
+
+static struct object *exit_builtin(struct object **args, size_t nargs) {
+	if (nargs > 1) {
+		printf("exit: wrong number of arguments, expected at most 1, got %lu\n", nargs);
+		exit(1);
+	}
+	if (nargs == 1 && args[0]->type != obj_integer) {
+		unsupported_type_error("exit", args[0]);
+	}
+
+	exit(nargs == 1 ? args[0]->data.i : 0);
+	return null_obj;
+}
+
+static struct object *new_builtin(struct object **args, size_t nargs) {
+	check_nargs("new", nargs, 0);
+	return new_class_obj();
+}
+
+#define BUILTIN(fn) &(struct object) { \
+	.data.builtin = fn, \
+	.type = obj_builtin, \
+	.dispose = dispose_builtin_obj, \
+	.print = print_obj \
+}
+
+// The position of each builtin is the index used by op_get_builtin.
+struct builtin builtins[NUM_BUILTINS] = {
+	{"len", BUILTIN(len_builtin)},
+	{"println", BUILTIN(println_builtin)},
+	{"print", BUILTIN(print_builtin)},
+	{"string", BUILTIN(string_builtin)},
+	{"int", BUILTIN(int_builtin)},
+	{"float", BUILTIN(float_builtin)},
+	{"append", BUILTIN(append_builtin)},
+	{"type", BUILTIN(type_builtin)},
+	{"exit", BUILTIN(exit_builtin)},
+	{"new", BUILTIN(new_builtin)}
+};
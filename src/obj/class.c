@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "obj.h"
+
+#define MIN_FIELDS 4
+
+static uint32_t shape_id = 0;
+
+// Shape of the objects without any field, root of the shape tree.
+static struct shape root_shape = {0};
+
+static inline int names_equal(struct object *a, struct object *b) {
+	return a == b || (
+		hash_obj(a) == hash_obj(b) &&
+		a->len == b->len &&
+		memcmp(a->data.str, b->data.str, a->len) == 0
+	);
+}
+
+// Returns the slot index of the field name or -1 if the shape doesn't have it.
+int shape_lookup(struct shape *s, struct object *name) {
+	for (int i = s->nfields - 1; i >= 0; i--) {
+		if (names_equal(s->keys[i], name)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Returns the shape obtained by adding the field name to s, reusing the
+// existing transition if an object already took the same path.
+static struct shape *shape_add_field(struct shape *s, struct object *name) {
+	for (size_t i = 0; i < s->ntransitions; i++) {
+		struct shape *child = s->transitions[i];
+
+		if (names_equal(child->keys[child->nfields-1], name)) {
+			return child;
+		}
+	}
+
+	struct shape *child = calloc(1, sizeof(struct shape));
+	child->parent = s;
+	child->nfields = s->nfields + 1;
+	child->id = ++shape_id;
+	child->keys = malloc(sizeof(struct object *) * child->nfields);
+	memcpy(child->keys, s->keys, sizeof(struct object *) * s->nfields);
+	child->keys[s->nfields] = name;
+
+	s->transitions = realloc(s->transitions, sizeof(struct shape *) * ++s->ntransitions);
+	s->transitions[s->ntransitions-1] = child;
+	return child;
+}
+
+struct object *class_get(struct object *o, struct object *name) {
+	struct instance *inst = o->data.inst;
+	int slot = shape_lookup(inst->shape, name);
+
+	return slot != -1 ? inst->fields[slot] : null_obj;
+}
+
+// Makes room in the object for at least nfields fields.
+void class_reserve(struct object *o, uint32_t nfields) {
+	struct instance *inst = o->data.inst;
+
+	if (nfields > inst->cap) {
+		uint32_t cap = inst->cap * 2;
+		while (cap < nfields) {
+			cap *= 2;
+		}
+
+		inst = realloc(inst, sizeof(struct instance) + sizeof(struct object *) * cap);
+		inst->cap = cap;
+		o->data.inst = inst;
+	}
+}
+
+// Sets the field and returns the slot index where the value was stored.
+int class_set(struct object *o, struct object *name, struct object *val) {
+	struct instance *inst = o->data.inst;
+	int slot = shape_lookup(inst->shape, name);
+
+	if (slot != -1) {
+		inst->fields[slot] = val;
+		return slot;
+	}
+
+	struct shape *shape = shape_add_field(inst->shape, name);
+	class_reserve(o, shape->nfields);
+	inst = o->data.inst;
+
+	slot = shape->nfields - 1;
+	inst->fields[slot] = val;
+	inst->shape = shape;
+	return slot;
+}
+
+static void dispose_class_obj(struct object *o) {
+	free(o->data.inst);
+	free(o);
+}
+
+struct object *new_class_obj() {
+	struct instance *inst = malloc(sizeof(struct instance) + sizeof(struct object *) * MIN_FIELDS);
+	inst->shape = &root_shape;
+	inst->cap = MIN_FIELDS;
+
+	struct object *o = calloc(1, sizeof(struct object));
+	o->data.inst = inst;
+	o->type = obj_class;
+	o->dispose = dispose_class_obj;
+	o->print = print_obj;
+
+	return o;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "obj.h"
+
+static const uint64_t pow10[] = {
+	1ULL,
+	10ULL,
+	100ULL,
+	1000ULL,
+	10000ULL,
+	100000ULL,
+	1000000ULL,
+	10000000ULL,
+	100000000ULL,
+	1000000000ULL,
+	10000000000ULL,
+	100000000000ULL,
+	1000000000000ULL,
+	10000000000000ULL,
+	100000000000000ULL,
+	1000000000000000ULL,
+	10000000000000000ULL,
+	100000000000000000ULL,
+	1000000000000000000ULL,
+	10000000000000000000ULL
+};
+
+static inline size_t uint_len(uint64_t u) {
+	size_t len = 1;
+
+	while (len < 20 && u >= pow10[len]) {
+		len++;
+	}
+	return len;
+}
+
+static inline size_t format_uint(char *buf, uint64_t u, size_t len) {
+	for (size_t i = len; i > 0; i--) {
+		buf[i-1] = '0' + u % 10;
+		u /= 10;
+	}
+	return len;
+}
+
+// Returns the number of characters needed to format i in base 10.
+size_t int_len(int64_t i) {
+	return i < 0 ? uint_len(-(uint64_t) i) + 1 : uint_len(i);
+}
+
+// Writes i in base 10 into buf, which must have room for int_len(i)
+// characters, and returns the number of characters written.
+size_t format_int(char *buf, int64_t i) {
+	if (i < 0) {
+		buf[0] = '-';
+		uint64_t u = -(uint64_t) i;
+		return format_uint(&buf[1], u, uint_len(u)) + 1;
+	}
+	return format_uint(buf, i, uint_len(i));
+}
+
+// Writes f into buf with the same output as printf's "%f", without the
+// terminating NUL, and returns the number of characters written, which
+// are never more than FLOAT_BUF_SIZE.
+// The fractional part is computed exactly from the binary value and
+// rounded half to even, as glibc does, using 128-bit arithmetic.
+// Values that don't fit in 63 bits and non finite ones go through
+// snprintf.
+size_t format_float(char *buf, double f) {
+	double x = fabs(f);
+
+	if (!isfinite(x) || x >= 0x1p63) {
+		char tmp[FLOAT_BUF_SIZE+1];
+		size_t len = snprintf(tmp, sizeof(tmp), "%f", f);
+		memcpy(buf, tmp, len);
+		return len;
+	}
+
+	uint64_t ip = (uint64_t) x;
+	double frac = x - ip;
+	uint64_t q = 0;
+
+	if (frac != 0) {
+		int exp;
+		uint64_t mant = ldexp(frexp(frac, &exp), 53);
+		int shift = 53 - exp;
+		unsigned __int128 prod = (unsigned __int128) mant * 1000000;
+
+		if (shift < 127) {
+			unsigned __int128 half = (unsigned __int128) 1 << (shift - 1);
+			unsigned __int128 rem = prod & ((half << 1) - 1);
+			q = prod >> shift;
+
+			if (rem > half || (rem == half && (q & 1))) {
+				q++;
+			}
+		}
+
+		if (q == 1000000) {
+			ip++;
+			q = 0;
+		}
+	}
+
+	size_t len = 0;
+	if (signbit(f)) {
+		buf[len++] = '-';
+	}
+	len += format_uint(&buf[len], ip, uint_len(ip));
+	buf[len++] = '.';
+	len += format_uint(&buf[len], q, 6);
+
+	return len;
+}
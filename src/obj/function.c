@@ -1,28 +1,82 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "obj.h"
+#include "../code/code.h"
+#include "../vm/jit.h"
+#include "../vm/trace.h"
+
+// Frees what the VM made from the function's code.
+static void dispose_derived(struct function *fn) {
+	if (fn->caches != NULL) {
+		for (size_t i = 0; i < fn->len; i++) {
+			free(fn->caches[i]);
+		}
+		free(fn->caches);
+	}
+	free(fn->threaded);
+	jit_dispose(fn->jit);
+	trace_dispose(fn->trace);
+}
 
 static void dispose_function_obj(struct object *o) {
+	dispose_derived(o->data.fn);
+	free(o->data.fn->captures);
+	free(o->data.fn->orig_instructions);
 	free(o->data.fn);
 	free(o);
 }
 
-static void print_function_obj(struct object *o) {
-	printf("closure[%p]\n", o->data.fn);
+// Replaces the function's code with one specialized from the original,
+// which is kept so that it can be specialized again. What the VM made
+// from the previous code is dropped.
+void function_specialize(struct function *fn, uint8_t *insts, size_t len, int num_locals) {
+	dispose_derived(fn);
+	if (fn->orig_instructions == NULL) {
+		fn->orig_instructions = fn->instructions;
+		fn->orig_len = fn->len;
+		fn->orig_num_locals = fn->num_locals;
+	} else {
+		free(fn->instructions);
+	}
+
+	fn->instructions = insts;
+	fn->len = len;
+	fn->num_locals = num_locals;
+	fn->max_stack = max_stack_depth(insts, len);
+	fn->caches = NULL;
+	fn->threaded = NULL;
+	fn->jit = NULL;
+	fn->calls = 0;
+	fn->trace = NULL;
+	fn->loops = 0;
+	fn->trace_aborts = 0;
 }
 
-struct object *new_function_obj(uint8_t *insts, size_t len, int num_params, int num_locals) {
+struct object *new_function_obj(uint8_t *insts, size_t len, int num_locals, int num_params, int max_stack) {
 	struct function *fn = malloc(sizeof(struct function));
 	fn->instructions = insts;
 	fn->len = len;
 	fn->num_locals = num_locals;
+	fn->orig_instructions = NULL;
+	fn->orig_len = 0;
+	fn->orig_num_locals = 0;
+	fn->max_stack = max_stack;
 	fn->num_params = num_params;
+	fn->num_free = 0;
+	fn->captures = NULL;
+	fn->caches = NULL;
+	fn->threaded = NULL;
+	fn->jit = NULL;
+	fn->calls = 0;
+	fn->trace = NULL;
+	fn->loops = 0;
+	fn->trace_aborts = 0;
 
 	struct object *o = calloc(1, sizeof(struct object));
 	o->data.fn = fn;
 	o->type = obj_function;
 	o->dispose = dispose_function_obj;
-	o->print = print_function_obj;
+	o->print = print_obj;
 
 	return o;
 }
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "obj.h"
+
+#define MIN_LISTBUF_CAP 8
+
+// Backing array shared by the lists obtained by appending to the same
+// list, in the same way strings share their buffers: a list whose length
+// equals the used slots owns the tail and append() extends it in place.
+// Since lists are mutable, a store copies a shared buffer first.
+struct listbuf {
+	size_t cap;
+	size_t used;
+	size_t refs;
+	struct object *items[];
+};
+
+#define LISTBUF(l) ((struct listbuf *) ((char *) (l) - offsetof(struct listbuf, items)))
+
+static void dispose_list_obj(struct object *o) {
+	struct listbuf *buf = LISTBUF(o->data.list);
+
+	if (--buf->refs == 0) {
+		free(buf);
+	}
+	free(o);
+}
+
+static inline struct listbuf *new_listbuf(size_t cap) {
+	struct listbuf *buf = malloc(sizeof(struct listbuf) + sizeof(struct object *) * cap);
+	buf->cap = cap;
+	buf->used = 0;
+	buf->refs = 0;
+
+	return buf;
+}
+
+static inline struct object *new_list_from_buf(struct listbuf *buf, size_t len) {
+	struct object *o = calloc(1, sizeof(struct object));
+	o->data.list = buf->items;
+	o->type = obj_list;
+	o->len = len;
+	o->dispose = dispose_list_obj;
+	o->print = print_obj;
+	buf->refs++;
+
+	return o;
+}
+
+// Copies the len items into a new list object.
+struct object *new_list_obj(struct object **items, size_t len) {
+	struct listbuf *buf = new_listbuf(len > MIN_LISTBUF_CAP ? len : MIN_LISTBUF_CAP);
+	memcpy(buf->items, items, sizeof(struct object *) * len);
+	buf->used = len;
+
+	return new_list_from_buf(buf, len);
+}
+
+// Returns a new list holding the items of l followed by the n items.
+struct object *list_append(struct object *l, struct object **items, size_t n) {
+	struct listbuf *buf = LISTBUF(l->data.list);
+	size_t len = l->len + n;
+
+	if (buf->used != l->len || buf->cap < len) {
+		buf = new_listbuf(len * 2 > MIN_LISTBUF_CAP ? len * 2 : MIN_LISTBUF_CAP);
+		memcpy(buf->items, l->data.list, sizeof(struct object *) * l->len);
+	}
+
+	memcpy(&buf->items[l->len], items, sizeof(struct object *) * n);
+	buf->used = len;
+
+	return new_list_from_buf(buf, len);
+}
+
+// Stores the value at the index, copying the items first if the buffer
+// is shared with other lists since they'd see the store too.
+void list_set(struct object *l, size_t i, struct object *val) {
+	struct listbuf *buf = LISTBUF(l->data.list);
+
+	if (buf->refs > 1) {
+		struct listbuf *copy = new_listbuf(l->len > MIN_LISTBUF_CAP ? l->len : MIN_LISTBUF_CAP);
+		memcpy(copy->items, l->data.list, sizeof(struct object *) * l->len);
+		copy->used = l->len;
+		copy->refs = 1;
+		buf->refs--;
+		l->data.list = copy->items;
+	}
+	l->data.list[i] = val;
+}
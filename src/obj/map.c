@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "obj.h"
+
+#define MIN_MAP_SIZE 8
+
+// Maximum load factor of the index is 3/4.
+#define OVERLOADED(len, nslots) ((len) * 4 >= (nslots) * 3)
+
+// FNV-1a on the string bytes, folded to 32 bits.
+static inline uint32_t hash_string(char *s, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t) s[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+// Finalizer of splitmix64, used to spread integer keys over the slots.
+static inline uint32_t hash_int(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return (uint32_t) x;
+}
+
+int is_hashable(struct object *o) {
+	switch (o->type) {
+	case obj_boolean:
+	case obj_integer:
+	case obj_float:
+	case obj_string:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+uint32_t hash_obj(struct object *o) {
+	switch (o->type) {
+	case obj_boolean:
+		return hash_int(o->data.i != 0) ^ obj_boolean;
+	case obj_integer:
+		return hash_int(o->data.i);
+	case obj_float: {
+		// Normalize -0.0 to 0.0 so that equal keys hash the same.
+		double f = o->data.f == 0 ? 0 : o->data.f;
+		uint64_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return hash_int(bits) ^ obj_float;
+	}
+	case obj_string:
+		// The hash is cached since string keys are often reused.
+		if (o->hash == 0) {
+			uint32_t h = hash_string(o->data.str, o->len);
+			o->hash = h != 0 ? h : 1;
+		}
+		return o->hash;
+	default:
+		return 0;
+	}
+}
+
+static inline int keys_equal(struct object *a, struct object *b) {
+	if (a == b) {
+		return 1;
+	}
+	if (a->type != b->type) {
+		return 0;
+	}
+
+	switch (a->type) {
+	case obj_boolean:
+	case obj_integer:
+		return a->data.i == b->data.i;
+	case obj_float:
+		return a->data.f == b->data.f;
+	case obj_string:
+		return a->len == b->len && memcmp(a->data.str, b->data.str, a->len) == 0;
+	default:
+		return 0;
+	}
+}
+
+// Returns the index slot holding key k or the empty slot where it belongs.
+static inline uint32_t *map_lookup_slot(struct map *m, struct object *k, uint32_t hash) {
+	size_t i = hash & m->mask;
+
+	for (;;) {
+		uint32_t *slot = &m->index[i];
+		if (*slot == 0) {
+			return slot;
+		}
+
+		struct map_entry *e = &m->entries[*slot-1];
+		if (e->hash == hash && keys_equal(e->key, k)) {
+			return slot;
+		}
+		i = (i + 1) & m->mask;
+	}
+}
+
+static void map_resize(struct map *m, size_t cap) {
+	size_t nslots = MIN_MAP_SIZE;
+	while (OVERLOADED(cap, nslots)) {
+		nslots <<= 1;
+	}
+
+	free(m->index);
+	m->index = calloc(nslots, sizeof(uint32_t));
+	m->mask = nslots - 1;
+	m->entries = realloc(m->entries, sizeof(struct map_entry) * cap);
+	m->cap = cap;
+
+	// The entries keep their position so only the index is rebuilt.
+	for (size_t i = 0; i < m->len; i++) {
+		size_t j = m->entries[i].hash & m->mask;
+
+		while (m->index[j] != 0) {
+			j = (j + 1) & m->mask;
+		}
+		m->index[j] = i + 1;
+	}
+}
+
+struct object *map_get(struct map *m, struct object *k) {
+	uint32_t slot = *map_lookup_slot(m, k, hash_obj(k));
+	return slot != 0 ? m->entries[slot-1].val : NULL;
+}
+
+void map_set(struct map *m, struct object *k, struct object *v) {
+	uint32_t hash = hash_obj(k);
+	uint32_t *slot = map_lookup_slot(m, k, hash);
+
+	if (*slot != 0) {
+		m->entries[*slot-1].val = v;
+		return;
+	}
+
+	if (m->len == m->cap) {
+		map_resize(m, m->cap * 2);
+		slot = map_lookup_slot(m, k, hash);
+	}
+
+	m->entries[m->len] = (struct map_entry) {.key = k, .val = v, .hash = hash};
+	*slot = ++m->len;
+}
+
+static void dispose_map_obj(struct object *o) {
+	free(o->data.map->entries);
+	free(o->data.map->index);
+	free(o->data.map);
+	free(o);
+}
+
+// Returns a new map object with room for size entries before growing.
+struct object *new_map_obj(size_t size) {
+	struct map *m = calloc(1, sizeof(struct map));
+	map_resize(m, size > MIN_MAP_SIZE ? size : MIN_MAP_SIZE);
+
+	struct object *o = calloc(1, sizeof(struct object));
+	o->data.map = m;
+	o->type = obj_map;
+	o->dispose = dispose_map_obj;
+	o->print = print_obj;
+
+	return o;
+}
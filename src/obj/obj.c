@@ -3,16 +3,12 @@
 
 static void dummy_dispose(struct object *o) {}
 
-static void print_null_obj(struct object *o) {
-	puts("null");
-}
-
 object *true_obj = &(struct object) {
 	.data.i = 1,
 	.type = obj_boolean,
 	.len = 0,
 	.dispose = dummy_dispose,
-	.print = print_boolean_obj
+	.print = print_obj
 };
 
 object *false_obj = &(struct object) {
@@ -20,7 +16,7 @@ object *false_obj = &(struct object) {
 	.type = obj_boolean,
 	.len = 0,
 	.dispose = dummy_dispose,
-	.print = print_boolean_obj
+	.print = print_obj
 };
 
 object *null_obj = &(struct object) {
@@ -28,7 +24,7 @@ object *null_obj = &(struct object) {
 	.type = obj_null,
 	.len = 0,
 	.dispose = dummy_dispose,
-	.print = print_null_obj
+	.print = print_obj
 };
 
 char *otype_str(enum obj_type t) {
@@ -41,7 +37,6 @@ char *otype_str(enum obj_type t) {
 		"error",
 		"float",
 		"function",
-		"getsetter",
 		"integer",
 		"list",
 		"map",
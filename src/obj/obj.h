@@ -13,7 +13,6 @@ enum obj_type {
 	obj_error,
 	obj_float,
 	obj_function,
-	obj_getsetter,
 	obj_integer,
 	obj_list,
 	obj_map,
@@ -25,19 +24,113 @@ enum obj_type {
 	obj_string
 };
 
+struct inline_cache;
+union tcode;
+struct jit_code;
+struct trace;
+
+// Where a closure finds a captured variable when it's created: in a
+// local slot of the enclosing frame or among the enclosing closure's
+// own captured variables.
+struct capture {
+	uint8_t local;
+	uint8_t index;
+};
+
 struct function {
 	uint8_t *instructions;
 	size_t len;
 	int num_locals;
+	// Code as compiled once the one above is specialized from it, NULL
+	// until then.
+	uint8_t *orig_instructions;
+	size_t orig_len;
+	int orig_num_locals;
+	int max_stack; // values pushed on top of the locals at most
 	int num_params;
+	int num_free;
+	struct capture *captures;
+	// Inline caches of the field access sites indexed by instruction offset.
+	struct inline_cache **caches;
+	// Direct-threaded translation, made on the first call in that mode.
+	union tcode *threaded;
+	// Native code, compiled once the function is called often enough.
+	struct jit_code *jit;
+	uint32_t calls;
+	// Trace of the loop through self tail calls, recorded once it's hot.
+	struct trace *trace;
+	uint32_t loops;
+	uint32_t trace_aborts;
 };
 
 typedef struct object object;
 
+struct map_entry {
+	struct object *key;
+	struct object *val;
+	uint32_t hash;
+};
+
+// Insertion-ordered open-addressing hash table.
+// The entries are stored in insertion order in a dense array while the
+// index is a power-of-two sized array of linearly probed slots holding
+// the position of each entry plus one (0 marks an empty slot).
+struct map {
+	struct map_entry *entries;
+	uint32_t *index;
+	size_t len;
+	size_t cap;
+	size_t mask;
+};
+
+// Captured variable. While the frame that declared it is alive it's
+// open and loc points to its stack slot; when the frame returns it's
+// closed by moving the value into the upvalue itself.
+// The closures that capture the same variable share its upvalue.
+struct upvalue {
+	struct object **loc;
+	struct object *closed;
+	struct upvalue *next; // next open upvalue, lower in the stack
+	uint32_t slot;
+};
+
+// Allocated together with its object, with the upvalues inline.
 struct closure {
 	struct function *fn;
-	struct object **free;
 	size_t num_free;
+	struct upvalue *free[];
+};
+
+// Hidden class shared by all the objects that had the same fields
+// added in the same order. Each field name maps to the index of the
+// slot where objects of this shape store the field value.
+struct shape {
+	struct shape *parent;
+	struct object **keys;
+	struct shape **transitions;
+	size_t ntransitions;
+	uint32_t nfields;
+	uint32_t id;
+};
+
+struct instance {
+	struct shape *shape;
+	uint32_t cap;
+	struct object *fields[];
+};
+
+// Growable buffer used to build the representation of objects.
+struct strbuilder {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+typedef struct object *(*builtinfn)(struct object **args, size_t nargs);
+
+struct builtin {
+	char *name;
+	struct object *obj;
 };
 
 union data {
@@ -47,28 +140,70 @@ union data {
 	struct object **list;
 	struct function *fn;
 	struct closure *cl;
+	struct map *map;
+	struct instance *inst;
+	builtinfn builtin;
 };
 
 struct object {
 	union data data;
 	enum obj_type type;
+	uint32_t hash; // cached hash of string keys, 0 if not computed yet
 	size_t len;
 	void (*dispose)(struct object *o);
 	void (*print)(struct object *o);
 };
 
-struct object *new_function_obj(uint8_t *insts, size_t len, int num_locals, int num_params);
-struct object *new_closure_obj(struct function *fn, struct object **free, size_t num_free);
+struct object *new_function_obj(uint8_t *insts, size_t len, int num_locals, int num_params, int max_stack);
+void function_specialize(struct function *fn, uint8_t *insts, size_t len, int num_locals);
+struct object *new_closure_obj(struct function *fn, struct upvalue **free, size_t num_free);
 struct object *new_boolean_obj(int b);
 struct object *new_integer_obj(int64_t val);
 struct object *new_float_obj(double val);
+struct object *new_string_obj(char *str, size_t len);
+struct object *new_string_with_len(size_t len);
+struct object *string_concat(struct object *a, struct object *b);
+int string_cmp(struct object *a, struct object *b);
+struct object *new_list_obj(struct object **items, size_t len);
+struct object *list_append(struct object *l, struct object **items, size_t n);
+void list_set(struct object *l, size_t i, struct object *val);
+struct object *new_map_obj(size_t size);
+struct object *new_class_obj();
 struct object *parse_bool(int b);
 char *otype_str(enum obj_type t);
 
-void print_boolean_obj(struct object *o);
+// Large enough for any double formatted with "%f".
+#define FLOAT_BUF_SIZE 320
+
+size_t int_len(int64_t i);
+size_t format_int(char *buf, int64_t i);
+size_t format_float(char *buf, double f);
+
+void sb_write(struct strbuilder *sb, char *s, size_t len);
+void sb_putc(struct strbuilder *sb, char c);
+void sb_write_int(struct strbuilder *sb, int64_t i);
+void sb_write_float(struct strbuilder *sb, double f);
+void sb_write_obj(struct strbuilder *sb, struct object *o, int quoted);
+
+void out_write(char *s, size_t len);
+void out_write_objs(struct object **objs, size_t n, int newline);
+void out_flush();
+void print_obj(struct object *o);
+
+int is_hashable(struct object *o);
+uint32_t hash_obj(struct object *o);
+struct object *map_get(struct map *m, struct object *k);
+void map_set(struct map *m, struct object *k, struct object *v);
+int shape_lookup(struct shape *s, struct object *name);
+struct object *class_get(struct object *o, struct object *name);
+int class_set(struct object *o, struct object *name, struct object *val);
+void class_reserve(struct object *o, uint32_t nfields);
 
 extern struct object *true_obj;
 extern struct object *false_obj;
 extern struct object *null_obj;
 
+#define NUM_BUILTINS 10
+extern struct builtin builtins[NUM_BUILTINS];
+
 #endif
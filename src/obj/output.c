@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "obj.h"
+
+// Output is flushed once this many bytes are buffered.
+#define OUT_FLUSH_SIZE 8192
+
+// Buffer for everything the interpreter writes to stdout.
+// It is written to the file descriptor directly so that the error
+// messages printed with stdio right before exiting come after the
+// output flushed by the exit handler.
+static struct {
+	struct strbuilder sb;
+	int tty;
+	int init;
+} out;
+
+void out_flush() {
+	size_t off = 0;
+
+	while (off < out.sb.len) {
+		ssize_t n = write(STDOUT_FILENO, &out.sb.data[off], out.sb.len - off);
+		if (n <= 0) {
+			break;
+		}
+		off += n;
+	}
+	out.sb.len = 0;
+}
+
+static inline struct strbuilder *out_begin() {
+	if (!out.init) {
+		out.tty = isatty(STDOUT_FILENO);
+		out.init = 1;
+		atexit(out_flush);
+	}
+	return &out.sb;
+}
+
+// Flushes the buffer if it's over the threshold, or if stdout is a
+// terminal and a line was completed since mark.
+static inline void out_end(size_t mark) {
+	if (out.sb.len >= OUT_FLUSH_SIZE) {
+		out_flush();
+	} else if (out.tty) {
+		for (size_t i = out.sb.len; i > mark; i--) {
+			if (out.sb.data[i-1] == '\n') {
+				out_flush();
+				break;
+			}
+		}
+	}
+}
+
+void out_write(char *s, size_t len) {
+	struct strbuilder *sb = out_begin();
+	size_t mark = sb->len;
+
+	sb_write(sb, s, len);
+	out_end(mark);
+}
+
+// Writes the objects separated by spaces, as print and println do.
+void out_write_objs(struct object **objs, size_t n, int newline) {
+	struct strbuilder *sb = out_begin();
+	size_t mark = sb->len;
+
+	for (size_t i = 0; i < n; i++) {
+		if (i > 0) sb_putc(sb, ' ');
+		sb_write_obj(sb, objs[i], 0);
+	}
+	if (newline) sb_putc(sb, '\n');
+	out_end(mark);
+}
+
+void print_obj(struct object *o) {
+	out_write_objs(&o, 1, 1);
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include "obj.h"
+
+#define MIN_BUILDER_CAP 64
+
+static inline void sb_grow(struct strbuilder *sb, size_t len) {
+	if (sb->len + len > sb->cap) {
+		size_t cap = sb->cap > 0 ? sb->cap * 2 : MIN_BUILDER_CAP;
+		while (cap < sb->len + len) {
+			cap *= 2;
+		}
+		sb->data = realloc(sb->data, cap);
+		sb->cap = cap;
+	}
+}
+
+void sb_write(struct strbuilder *sb, char *s, size_t len) {
+	sb_grow(sb, len);
+	memcpy(&sb->data[sb->len], s, len);
+	sb->len += len;
+}
+
+void sb_putc(struct strbuilder *sb, char c) {
+	sb_grow(sb, 1);
+	sb->data[sb->len++] = c;
+}
+
+void sb_write_int(struct strbuilder *sb, int64_t i) {
+	sb_grow(sb, int_len(i));
+	sb->len += format_int(&sb->data[sb->len], i);
+}
+
+void sb_write_float(struct strbuilder *sb, double f) {
+	sb_grow(sb, FLOAT_BUF_SIZE);
+	sb->len += format_float(&sb->data[sb->len], f);
+}
+
+static void sb_write_ptr(struct strbuilder *sb, struct object *o) {
+	static const char digits[] = "0123456789abcdef";
+	uintptr_t p = (uintptr_t) o;
+	char buf[2 * sizeof(uintptr_t)];
+	int i = sizeof(buf);
+
+	do {
+		buf[--i] = digits[p & 0xf];
+		p >>= 4;
+	} while (p != 0);
+
+	char *type = otype_str(o->type);
+	sb_write(sb, type, strlen(type));
+	sb_write(sb, "[0x", 3);
+	sb_write(sb, &buf[i], sizeof(buf) - i);
+	sb_putc(sb, ']');
+}
+
+// Writes the representation of the object. Strings are written as they
+// are unless quoted is set, which is the case for strings inside
+// containers.
+void sb_write_obj(struct strbuilder *sb, struct object *o, int quoted) {
+	switch (o->type) {
+	case obj_string:
+		if (quoted) sb_putc(sb, '"');
+		sb_write(sb, o->data.str, o->len);
+		if (quoted) sb_putc(sb, '"');
+		break;
+
+	case obj_integer:
+		sb_write_int(sb, o->data.i);
+		break;
+
+	case obj_float:
+		sb_write_float(sb, o->data.f);
+		break;
+
+	case obj_boolean:
+		if (o->data.i) {
+			sb_write(sb, "true", 4);
+		} else {
+			sb_write(sb, "false", 5);
+		}
+		break;
+
+	case obj_null:
+		sb_write(sb, "null", 4);
+		break;
+
+	case obj_list:
+		sb_putc(sb, '[');
+		for (size_t i = 0; i < o->len; i++) {
+			if (i > 0) sb_write(sb, ", ", 2);
+			sb_write_obj(sb, o->data.list[i], 1);
+		}
+		sb_putc(sb, ']');
+		break;
+
+	case obj_map: {
+		struct map *m = o->data.map;
+
+		sb_putc(sb, '{');
+		for (size_t i = 0; i < m->len; i++) {
+			if (i > 0) sb_write(sb, ", ", 2);
+			sb_write_obj(sb, m->entries[i].key, 1);
+			sb_write(sb, ": ", 2);
+			sb_write_obj(sb, m->entries[i].val, 1);
+		}
+		sb_putc(sb, '}');
+		break;
+	}
+
+	case obj_class: {
+		struct instance *inst = o->data.inst;
+
+		sb_putc(sb, '{');
+		for (uint32_t i = 0; i < inst->shape->nfields; i++) {
+			if (i > 0) sb_write(sb, ", ", 2);
+			sb_write_obj(sb, inst->shape->keys[i], 0);
+			sb_write(sb, ": ", 2);
+			sb_write_obj(sb, inst->fields[i], 1);
+		}
+		sb_putc(sb, '}');
+		break;
+	}
+
+	default:
+		sb_write_ptr(sb, o);
+		break;
+	}
+}
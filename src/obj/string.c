@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "obj.h"
+
+#define MIN_STRBUF_CAP 16
+
+// Buffer shared by the strings obtained by appending to the same string.
+// All of them start at the beginning of the buffer and differ only in
+// length, so a string whose length equals the used bytes owns the tail
+// of the buffer and can be extended in place.
+// Since the bytes past the end of a string may belong to a longer one,
+// strings aren't guaranteed to be NUL-terminated and must be accessed
+// through their length.
+struct strbuf {
+	size_t cap;
+	size_t used;
+	size_t refs;
+	char data[];
+};
+
+#define STRBUF(s) ((struct strbuf *) ((s) - offsetof(struct strbuf, data)))
+
+static void dispose_string_obj(struct object *o) {
+	struct strbuf *buf = STRBUF(o->data.str);
+
+	if (--buf->refs == 0) {
+		free(buf);
+	}
+	free(o);
+}
+
+static inline struct strbuf *new_strbuf(size_t cap) {
+	struct strbuf *buf = malloc(sizeof(struct strbuf) + sizeof(char) * cap);
+	buf->cap = cap;
+	buf->used = 0;
+	buf->refs = 0;
+
+	return buf;
+}
+
+static inline struct object *new_string_from_buf(struct strbuf *buf, size_t len) {
+	struct object *o = calloc(1, sizeof(struct object));
+	o->data.str = buf->data;
+	o->type = obj_string;
+	o->len = len;
+	o->dispose = dispose_string_obj;
+	o->print = print_obj;
+	buf->refs++;
+
+	return o;
+}
+
+// Returns a new string object of the given length whose content is
+// meant to be filled by the caller.
+struct object *new_string_with_len(size_t len) {
+	struct strbuf *buf = new_strbuf(len + 1);
+	buf->data[len] = '\0';
+	buf->used = len;
+
+	return new_string_from_buf(buf, len);
+}
+
+// Copies the first len bytes of str into a new string object.
+struct object *new_string_obj(char *str, size_t len) {
+	struct strbuf *buf = new_strbuf(len + 1);
+	memcpy(buf->data, str, len);
+	buf->data[len] = '\0';
+	buf->used = len;
+
+	return new_string_from_buf(buf, len);
+}
+
+// Returns a new string object holding a followed by b.
+// When a owns the tail of its buffer b is appended in place, otherwise
+// both are copied in a new buffer with room to grow, so that repeatedly
+// appending to a string takes amortized linear time.
+struct object *string_concat(struct object *a, struct object *b) {
+	struct strbuf *buf = STRBUF(a->data.str);
+	size_t len = a->len + b->len;
+
+	if (buf->used != a->len || buf->cap <= len) {
+		size_t cap = len * 2 > MIN_STRBUF_CAP ? len * 2 : MIN_STRBUF_CAP;
+		buf = new_strbuf(cap);
+		memcpy(buf->data, a->data.str, a->len);
+	}
+
+	memcpy(&buf->data[a->len], b->data.str, b->len);
+	buf->data[len] = '\0';
+	buf->used = len;
+
+	return new_string_from_buf(buf, len);
+}
+
+// Compares the two strings lexicographically like strcmp.
+int string_cmp(struct object *a, struct object *b) {
+	size_t len = a->len < b->len ? a->len : b->len;
+	int cmp = memcmp(a->data.str, b->data.str, len);
+
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (a->len > b->len) - (a->len < b->len);
+}
@@ -24,6 +24,8 @@ enum precedence {
 static inline enum precedence get_precedence(enum item_type type);
 static inline prefixfn prefix_parser(enum item_type type);
 static inline infixfn infix_parser(enum item_type type);
+static struct node *parse_expr(struct parser *p, enum precedence prec);
+struct parser new_parser(struct item *items, size_t nitems);
 
 static inline void enter_loop(struct parser *p) {
 	p->nested_loops++;
@@ -84,10 +86,6 @@ static struct node *parse_expr(struct parser *p, enum precedence prec) {
 		next(p);
 		left = ifn(p, left);
 	}
-
-	if (item_is(p->peek, item_semicolon)) {
-		next(p);
-	}
 	return left;
 }
 
@@ -189,6 +187,178 @@ static struct node *parse_integer(struct parser *p) {
 	return new_integer(val);
 }
 
+// Returns a newly allocated copy of the string literal with the escape
+// sequences replaced by the characters they represent.
+static char *unescape(struct string lit, size_t *len) {
+	char *str = malloc(sizeof(char) * (lit.len + 1));
+	size_t n = 0;
+
+	for (size_t i = 0; i < lit.len; i++) {
+		char c = lit.val[i];
+
+		if (c == '\\' && i + 1 < lit.len) {
+			switch (lit.val[++i]) {
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case '0':
+				c = '\0';
+				break;
+			default:
+				c = lit.val[i];
+				break;
+			}
+		}
+		str[n++] = c;
+	}
+
+	str[n] = '\0';
+	*len = n;
+	return str;
+}
+
+// Parses the source of an expression between braces in a string.
+static struct node *parse_interpolated_expr(char *input, size_t len) {
+	struct lexer l = new_lexer(input, len);
+	lexer_run(&l);
+
+	struct parser p = new_parser(l.items, l.nitems);
+	struct node *expr = parse_expr(&p, lowest);
+	free(l.items);
+
+	if (expr == NULL) {
+		puts("invalid expression in interpolated string");
+		exit(1);
+	}
+	return expr;
+}
+
+// Splits the string literal in the literal parts and the expressions
+// between braces, so that op_interpolate only has to join them.
+static struct node *parse_string(struct parser *p) {
+	struct string lit = p->cur.lit;
+	char **parts = NULL;
+	size_t *lens = NULL;
+	struct node **exprs = NULL;
+	size_t nexprs = 0;
+	size_t start = 0;
+
+	for (size_t i = 0; i < lit.len;) {
+		if (lit.val[i] == '\\') {
+			i += 2;
+			continue;
+		} else if (lit.val[i] != '{') {
+			i++;
+			continue;
+		}
+
+		size_t end = i + 1;
+		for (int depth = 1; depth > 0; end++) {
+			if (end >= lit.len) {
+				puts("unterminated interpolation in string");
+				exit(1);
+			} else if (lit.val[end] == '\\') {
+				end++;
+			} else if (lit.val[end] == '{') {
+				depth++;
+			} else if (lit.val[end] == '}') {
+				depth--;
+			}
+		}
+
+		parts = realloc(parts, sizeof(char *) * (nexprs + 1));
+		lens = realloc(lens, sizeof(size_t) * (nexprs + 1));
+		parts[nexprs] = unescape(slice_str(&lit.val[start], i - start), &lens[nexprs]);
+
+		size_t srclen = 0;
+		char *src = unescape(slice_str(&lit.val[i+1], end - i - 2), &srclen);
+		exprs = realloc(exprs, sizeof(struct node *) * ++nexprs);
+		exprs[nexprs-1] = parse_interpolated_expr(src, srclen);
+		free(src);
+
+		start = i = end;
+	}
+
+	size_t len = 0;
+	char *str = unescape(slice_str(&lit.val[start], lit.len - start), &len);
+
+	if (nexprs == 0) {
+		return new_string(str, len);
+	}
+
+	parts = realloc(parts, sizeof(char *) * (nexprs + 1));
+	lens = realloc(lens, sizeof(size_t) * (nexprs + 1));
+	parts[nexprs] = str;
+	lens[nexprs] = len;
+	return new_interpolated(parts, lens, exprs, nexprs);
+}
+
+static struct node *parse_map(struct parser *p) {
+	struct node **keys = NULL;
+	struct node **vals = NULL;
+	size_t len = 0;
+
+	while (!item_is(p->peek, item_rbrace)) {
+		next(p);
+		struct node *key = parse_expr(p, lowest);
+
+		if (!expect_peek(p, item_colon)) {
+			exit(1);
+		}
+		next(p);
+
+		keys = realloc(keys, sizeof(struct node *) * ++len);
+		vals = realloc(vals, sizeof(struct node *) * len);
+		keys[len-1] = key;
+		vals[len-1] = parse_expr(p, lowest);
+
+		if (!item_is(p->peek, item_rbrace) && !expect_peek(p, item_comma)) {
+			exit(1);
+		}
+	}
+
+	if (!expect_peek(p, item_rbrace)) {
+		exit(1);
+	}
+
+	return new_map(keys, vals, len);
+}
+
+static struct node *parse_list(struct parser *p) {
+	struct node **elems = NULL;
+	size_t len = parse_node_sequence(p, &elems, item_comma, item_rbracket);
+
+	return new_list(elems, len);
+}
+
+static struct node *parse_index(struct parser *p, struct node *left) {
+	next(p);
+	struct node *index = parse_expr(p, lowest);
+
+	if (!expect_peek(p, item_rbracket)) {
+		exit(1);
+	}
+
+	return new_index(left, index);
+}
+
+static struct node *parse_dot(struct parser *p, struct node *left) {
+	if (!expect_peek(p, item_ident)) {
+		exit(1);
+	}
+
+	char *field = calloc(p->cur.lit.len + 1, sizeof(char));
+	strncpy(field, p->cur.lit.val, p->cur.lit.len);
+
+	return new_dot(left, field, p->cur.lit.len);
+}
+
 static struct node *parse_grouped_expr(struct parser *p) {
 	next(p);
 	struct node *expr = parse_expr(p, lowest);
@@ -215,11 +385,19 @@ static struct node *parse_return(struct parser *p) {
 	return ret;
 }
 
+// The semicolon is consumed only here at the end of the statement:
+// if a nested expression consumed it, the statement would go on parsing
+// what follows it, e.g. "a = 1; [a]" as "a = 1[a]".
 static struct node *parse_statement(struct parser *p) {
 	if (item_is(p->cur, item_return)) {
 		return parse_return(p);
 	}
-	return parse_expr(p, lowest);
+
+	struct node *expr = parse_expr(p, lowest);
+	if (item_is(p->peek, item_semicolon)) {
+		next(p);
+	}
+	return expr;
 }
 
 static struct node *parse_block(struct parser *p) {
@@ -424,8 +602,8 @@ static inline prefixfn prefix_parser(enum item_type type) {
 		return parse_integer;
 	// case item_float:
 	// 	return parse_float;
-	// case item_string:
-	// 	return parse_string;
+	case item_string:
+		return parse_string;
 	// case item_rawstring:
 	// 	return parse_rawstring;
 	// case item_minus:
@@ -442,16 +620,16 @@ static inline prefixfn prefix_parser(enum item_type type) {
 		return parse_ifexpr;
 	case item_function:
 		return parse_function;
-	// case item_lbracket:
-	// 	return parse_list;
+	case item_lbracket:
+		return parse_list;
 	// case item_plusplus:
 	// 	return parse_plusplus;
 	// case item_minusminus:
 	// 	return parse_minusminus;
 	// case item_for:
 	// 	return parse_for;
-	// case item_lbrace:
-	// 	return parse_map;
+	case item_lbrace:
+		return parse_map;
 	// case item_null:
 	// 	return parse_null;
 	// case item_bwnot:
@@ -531,10 +709,10 @@ static inline infixfn infix_parser(enum item_type type) {
 	// 	return parse_rshift_assign;
 	case item_lparen:
 		return parse_call;
-	// case item_lbracket:
-	// 	return parse_index;
-	// case item_dot:
-	// 	return parse_dot;
+	case item_lbracket:
+		return parse_index;
+	case item_dot:
+		return parse_dot;
 	default:
 		return NULL;
 	}
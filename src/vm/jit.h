@@ -0,0 +1,53 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Number of calls after which a function is compiled to native code
+// when the JIT is enabled without an explicit threshold.
+#define JIT_THRESHOLD 100
+
+// Deepest nesting of native calls, past which the callees are left to
+// the interpreter so that the C stack stays bounded.
+#define JIT_MAX_DEPTH 1024
+
+// Returned by the native code when the function returned, its frame
+// being popped already.
+#define JIT_RETURNED UINT32_MAX
+
+struct vm;
+struct frame;
+struct function;
+
+// Handler of an opcode called by the native code, a and b are the
+// instruction's operands. The instructions that use an inline cache get
+// their bytecode offset as a instead. Only op_jump_not_truthy uses the
+// result: the truthiness of the condition it popped.
+typedef uintptr_t (*jit_stub)(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b);
+
+// Handlers of the calls and returns, which push and pop frames. The
+// call gets the offset of the next instruction as b and returns the
+// caller's frame, which can have moved, or 0 if the callee was left to
+// the interpreter. The tail call returns whether it looped back to the
+// start of the function, or 0 if it was left to the interpreter.
+struct jit_calls {
+	jit_stub call;
+	jit_stub tail_call;
+	jit_stub ret;
+	jit_stub return_value;
+};
+
+// Native code of a function, mapped together with its entry points so
+// that the interpreter can resume it at any instruction.
+struct jit_code {
+	size_t size;
+	uint8_t *code;
+	uint32_t entries[]; // code offset of each instruction by bytecode offset
+};
+
+struct jit_code *jit_compile(struct function *fn, const jit_stub *stubs, const struct jit_calls *calls);
+size_t jit_run(struct jit_code *jc, struct vm *vm, struct frame *frame, size_t offset);
+void jit_dispose(struct jit_code *jc);
+
+#endif
@@ -1,63 +1,63 @@
-#ifndef JUMP_TABLE_H_
-#define JUMP_TABLE_H_
-
-static const void *jump_table[] = {
-	&&TARGET_CONST,
-	&&TARGET_TRUE,
-	&&TARGET_FALSE,
-	&&TARGET_NULL,
-	&&TARGET_LIST,
-	&&TARGET_MAP,
-	&&TARGET_CLOSURE,
-	&&TARGET_CURRENT_CLOSURE,
-
-	&&TARGET_ADD,
-	&&TARGET_SUB,
-	&&TARGET_MUL,
-	&&TARGET_DIV,
-	&&TARGET_MOD,
-
-	&&TARGET_BW_AND,
-	&&TARGET_BW_OR,
-	&&TARGET_BW_XOR,
-	&&TARGET_BW_NOT,
-	&&TARGET_BW_LSHIFT,
-	&&TARGET_BW_RSHIFT,
-
-	&&TARGET_AND,
-	&&TARGET_OR,
-	&&TARGET_EQUAL,
-	&&TARGET_NOT_EQUAL,
-	&&TARGET_GREATER_THAN,
-	&&TARGET_GREATER_THAN_EQUAL,
-
-	&&TARGET_MINUS,
-	&&TARGET_BANG,
-	&&TARGET_INDEX,
-
-	&&TARGET_CALL,
-	&&TARGET_CONCURRENT_CALL,
-	&&TARGET_RETURN,
-	&&TARGET_RETURN_VALUE,
-
-	&&TARGET_JUMP,
-	&&TARGET_JUMP_NOT_TRUTHY,
-
-	&&TARGET_DOT,
-	&&TARGET_DEFINE,
-	&&TARGET_GET_GLOBAL,
-	&&TARGET_SET_GLOBAL,
-	&&TARGET_GET_LOCAL,
-	&&TARGET_SET_LOCAL,
-	&&TARGET_GET_BUILTIN,
-	&&TARGET_GET_FREE,
-	&&TARGET_LOAD_MODULE,
-	&&TARGET_INTERPOLATE,
-
-	&&TARGET_POP,
-	&&TARGET_HALT
-};
-
-
-#endif // JUMP_TABLE_H_
+// Handlers of the opcodes in their order, included in the table of each
+// interpreter loop, which defines TARGET_ADDR. It has no include guard.
+	TARGET_ADDR(CONST),
+	TARGET_ADDR(TRUE),
+	TARGET_ADDR(FALSE),
+	TARGET_ADDR(NULL),
+	TARGET_ADDR(LIST),
+	TARGET_ADDR(MAP),
+	TARGET_ADDR(CLOSURE),
+	TARGET_ADDR(CURRENT_CLOSURE),
+
+	TARGET_ADDR(ADD),
+	TARGET_ADDR(SUB),
+	TARGET_ADDR(MUL),
+	TARGET_ADDR(DIV),
+	TARGET_ADDR(MOD),
+	TARGET_ADDR(ADD_TMP),
+	TARGET_ADDR(SUB_TMP),
+
+	TARGET_ADDR(BW_AND),
+	TARGET_ADDR(BW_OR),
+	TARGET_ADDR(BW_XOR),
+	TARGET_ADDR(BW_NOT),
+	TARGET_ADDR(BW_LSHIFT),
+	TARGET_ADDR(BW_RSHIFT),
+
+	TARGET_ADDR(AND),
+	TARGET_ADDR(OR),
+	TARGET_ADDR(EQUAL),
+	TARGET_ADDR(NOT_EQUAL),
+	TARGET_ADDR(GREATER_THAN),
+	TARGET_ADDR(GREATER_THAN_EQUAL),
+
+	TARGET_ADDR(MINUS),
+	TARGET_ADDR(BANG),
+	TARGET_ADDR(INDEX),
+
+	TARGET_ADDR(CALL),
+	TARGET_ADDR(CALL_BUILTIN),
+	TARGET_ADDR(TAIL_CALL),
+	TARGET_ADDR(CONCURRENT_CALL),
+	TARGET_ADDR(RETURN),
+	TARGET_ADDR(RETURN_VALUE),
+
+	TARGET_ADDR(JUMP),
+	TARGET_ADDR(JUMP_NOT_TRUTHY),
+
+	TARGET_ADDR(DOT),
+	TARGET_ADDR(DEFINE),
+	TARGET_ADDR(GET_GLOBAL),
+	TARGET_ADDR(SET_GLOBAL),
+	TARGET_ADDR(GET_LOCAL),
+	TARGET_ADDR(SET_LOCAL),
+	TARGET_ADDR(GET_BUILTIN),
+	TARGET_ADDR(GET_FREE),
+	TARGET_ADDR(SET_FREE),
+	TARGET_ADDR(LOAD_MODULE),
+	TARGET_ADDR(INTERPOLATE),
+
+	TARGET_ADDR(POP),
+	TARGET_ADDR(HALT)
+
 
@@ -0,0 +1,344 @@
+// Opcode handlers shared by the interpreter loops, included in their
+// bodies, or as functions in the tail-calling one. TARGET starts each
+// handler, the operands are read and the jumps are done through the
+// macros each loop defines, and LOOP_HEADER is run when a tail call jumps
+// back to the start of the same function. The stack is handled through
+// the loops' sp and bp.
+
+	TARGET(CONST) {
+		uint16_t idx = OPERAND16();
+		PUSH(consts[idx]);
+		DISPATCH();
+	}
+
+	TARGET(TRUE) {
+		PUSH(true_obj);
+		DISPATCH();
+	}
+
+	TARGET(FALSE) {
+		PUSH(false_obj);
+		DISPATCH();
+	}
+
+	TARGET(NULL) {
+		PUSH(null_obj);
+		DISPATCH();
+	}
+
+	TARGET(LIST) {
+		uint16_t len = OPERAND16();
+		struct object *list = new_list_obj(sp - len, len);
+		sp -= len;
+		PUSH(list);
+		DISPATCH();
+	}
+
+	TARGET(MAP) {
+		uint16_t nelems = OPERAND16();
+		struct object *map = vm_exec_map(sp - nelems, nelems);
+		sp -= nelems;
+		PUSH(map);
+		DISPATCH();
+	}
+
+	TARGET(CLOSURE) {
+		uint16_t const_idx = OPERAND16();
+		(void) OPERAND8();
+		PUSH(vm_new_closure(vm, frame, const_idx));
+		DISPATCH();
+	}
+
+	TARGET(CURRENT_CLOSURE) {
+		PUSH(frame->cl);
+		DISPATCH();
+	}
+
+	TARGET(ADD) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_add(vm, left, right, 0));
+		DISPATCH();
+	}
+
+	TARGET(SUB) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_sub(vm, left, right, 0));
+		DISPATCH();
+	}
+
+	TARGET(MUL) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_mul(left, right));
+		DISPATCH();
+	}
+
+	TARGET(DIV) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_div(left, right));
+		DISPATCH();
+	}
+
+	TARGET(MOD) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_mod(left, right));
+		DISPATCH();
+	}
+
+	TARGET(ADD_TMP) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_add(vm, left, right, 1));
+		DISPATCH();
+	}
+
+	TARGET(SUB_TMP) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_sub(vm, left, right, 1));
+		DISPATCH();
+	}
+
+	TARGET(BW_AND) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_and(left, right));
+		DISPATCH();
+	}
+
+	TARGET(BW_OR) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_or(left, right));
+		DISPATCH();
+	}
+
+	TARGET(BW_XOR) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(BW_NOT) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(BW_LSHIFT) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(BW_RSHIFT) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(AND) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_and(left, right));
+		DISPATCH();
+	}
+
+	TARGET(OR) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_or(left, right));
+		DISPATCH();
+	}
+
+	TARGET(EQUAL) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_eq(left, right));
+		DISPATCH();
+	}
+
+	TARGET(NOT_EQUAL) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_not_eq(left, right));
+		DISPATCH();
+	}
+
+	TARGET(GREATER_THAN) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_greater_than(left, right));
+		DISPATCH();
+	}
+
+	TARGET(GREATER_THAN_EQUAL) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_greater_than_eq(left, right));
+		DISPATCH();
+	}
+
+	TARGET(MINUS) {
+		sp[-1] = vm_exec_minus(sp[-1]);
+		DISPATCH();
+	}
+
+	TARGET(BANG) {
+		sp[-1] = vm_exec_bang(sp[-1]);
+		DISPATCH();
+	}
+
+	TARGET(INDEX) {
+		struct object *right = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_index(left, right));
+		DISPATCH();
+	}
+
+	TARGET(CALL) {
+		uint8_t num_args = OPERAND8();
+		SAVE_STATE();
+		vm_exec_call(vm, num_args);
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	TARGET(CALL_BUILTIN) {
+		uint8_t idx = OPERAND8();
+		uint8_t num_args = OPERAND8();
+
+		struct object *res = builtins[idx].obj->data.builtin(sp - num_args, num_args);
+		sp -= num_args;
+		PUSH(res);
+		DISPATCH();
+	}
+
+	TARGET(TAIL_CALL) {
+		uint8_t num_args = OPERAND8();
+		// A closure calling itself in tail position is a loop.
+		int loop = sp[-1-num_args] == frame->cl;
+		SAVE_STATE();
+		vm_exec_tail_call(vm, frame, num_args);
+		if (loop) LOOP_HEADER();
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	TARGET(CONCURRENT_CALL) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(RETURN) {
+		SAVE_STATE();
+		vm_exec_return(vm);
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	TARGET(RETURN_VALUE) {
+		SAVE_STATE();
+		vm_exec_return_value(vm);
+		LOAD_FRAME();
+		DISPATCH();
+	}
+
+	TARGET(JUMP) {
+		uintptr_t pos = OPERAND16();
+		JUMP(pos);
+		DISPATCH();
+	}
+
+	TARGET(JUMP_NOT_TRUTHY) {
+		uintptr_t pos = OPERAND16();
+
+		struct object *cond = POP();
+		if (!is_truthy(cond)) {
+			JUMP(pos);
+		}
+		DISPATCH();
+	}
+
+	TARGET(DOT) {
+		struct inline_cache *ic = vm_inline_cache(frame->cl->data.cl->fn, INSTR_OFFSET());
+		struct object *name = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_dot(ic, left, name));
+		DISPATCH();
+	}
+
+	TARGET(DEFINE) {
+		size_t offset = INSTR_OFFSET();
+		struct object *val = POP();
+		struct object *index = POP();
+		struct object *left = POP();
+		PUSH(vm_exec_define(frame->cl->data.cl->fn, offset, left, index, val));
+		DISPATCH();
+	}
+
+	TARGET(GET_GLOBAL) {
+		int global_idx = OPERAND16();
+		PUSH(globals[global_idx]);
+		DISPATCH();
+	}
+
+	TARGET(SET_GLOBAL) {
+		int global_idx = OPERAND16();
+		globals[global_idx] = PEEK();
+		DISPATCH();
+	}
+
+	TARGET(GET_LOCAL) {
+		int local_idx = OPERAND8();
+		PUSH(bp[local_idx]);
+		DISPATCH();
+	}
+
+	TARGET(SET_LOCAL) {
+		int local_idx = OPERAND8();
+		bp[local_idx] = PEEK();
+		DISPATCH();
+	}
+
+	TARGET(GET_BUILTIN) {
+		int idx = OPERAND8();
+		PUSH(builtins[idx].obj);
+		DISPATCH();
+	}
+
+	TARGET(GET_FREE) {
+		int free_idx = OPERAND8();
+		PUSH(*frame->free[free_idx]->loc);
+		DISPATCH();
+	}
+
+	TARGET(SET_FREE) {
+		int free_idx = OPERAND8();
+		*frame->free[free_idx]->loc = PEEK();
+		DISPATCH();
+	}
+
+	TARGET(LOAD_MODULE) {
+		UNHANDLED();
+		DISPATCH();
+	}
+
+	TARGET(INTERPOLATE) {
+		uint16_t const_idx = OPERAND16();
+		uint16_t nsubs = OPERAND16();
+		struct object *res = vm_exec_interpolate(&consts[const_idx], sp - nsubs, nsubs);
+		sp -= nsubs;
+		PUSH(res);
+		DISPATCH();
+	}
+
+	TARGET(POP) {
+		sp--;
+		DISPATCH();
+	}
+
+	TARGET(HALT) {
+		SAVE_STATE();
+		return 0;
+	}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+
+#include "trace.h"
+#include "../code/code.h"
+#include "../obj/obj.h"
+
+static inline int both_integers(struct trace_rec r) {
+	return r.types[0] == obj_integer && r.types[1] == obj_integer;
+}
+
+static inline struct trace_ins *trace_emit(struct trace *t, enum trace_op op, uint32_t exit) {
+	struct trace_ins *ins = &t->insts[t->len++];
+	*ins = (struct trace_ins) {.op = op, .exit = exit};
+	return ins;
+}
+
+// Returns where the recorded branch goes when it doesn't go the
+// recorded way.
+static inline uint32_t branch_exit(struct trace_rec jnt, uint8_t *insts) {
+	if (jnt.taken) {
+		return jnt.offset + instruction_len(op_jump_not_truthy);
+	}
+	return read_uint16(&insts[jnt.offset+1]);
+}
+
+// Builds the trace of the recorded loop body, specializing the
+// arithmetic and the comparisons to the observed types. The comparisons
+// of integers followed by a branch are fused in a single guard.
+struct trace *trace_compile(struct function *fn, struct trace_rec *recs, size_t len, const jit_stub *stubs) {
+	struct trace *t = malloc(sizeof(struct trace));
+	t->insts = malloc(sizeof(struct trace_ins) * len);
+	t->len = 0;
+
+	uint8_t *insts = fn->instructions;
+	for (size_t i = 0; i < len; i++) {
+		struct trace_rec r = recs[i];
+		struct definition def = definitions[r.op];
+		uint32_t operands[2] = {0};
+		size_t off = r.offset + 1;
+
+		for (int j = 0; j < def.noperands; j++) {
+			operands[j] = def.opwidths[j] == 2 ? read_uint16(&insts[off]) : read_uint8(&insts[off]);
+			off += def.opwidths[j];
+		}
+
+		struct trace_ins *ins;
+		switch (r.op) {
+		case op_constant:
+			trace_emit(t, tr_const, r.offset)->a = operands[0];
+			break;
+		case op_get_local:
+			trace_emit(t, tr_get_local, r.offset)->a = operands[0];
+			break;
+		case op_set_local:
+			trace_emit(t, tr_set_local, r.offset)->a = operands[0];
+			break;
+		case op_get_global:
+			trace_emit(t, tr_get_global, r.offset)->a = operands[0];
+			break;
+		case op_pop:
+			trace_emit(t, tr_pop, r.offset);
+			break;
+		case op_jump:
+			break;
+
+		case op_add:
+		case op_sub:
+		case op_add_tmp:
+		case op_sub_tmp:
+			if (!both_integers(r)) {
+				goto generic;
+			}
+			ins = trace_emit(t, r.op == op_add || r.op == op_add_tmp ? tr_add_int : tr_sub_int, r.offset);
+			ins->flag = r.op == op_add_tmp || r.op == op_sub_tmp;
+			break;
+
+		case op_greater_than:
+		case op_greater_than_equal:
+			if (!both_integers(r) || i + 1 == len || recs[i+1].op != op_jump_not_truthy) {
+				goto generic;
+			}
+			// The types are checked before popping the operands, so a
+			// failed type check exits at the comparison and a failed
+			// branch at b.
+			ins = trace_emit(t, r.op == op_greater_than ? tr_guard_gt_int : tr_guard_gte_int, r.offset);
+			ins->flag = !recs[i+1].taken;
+			ins->b = branch_exit(recs[i+1], insts);
+			i++;
+			break;
+
+		case op_jump_not_truthy:
+			ins = trace_emit(t, tr_guard, branch_exit(r, insts));
+			ins->flag = !r.taken;
+			ins->stub = stubs[op_jump_not_truthy];
+			break;
+
+		case op_tail_call:
+			trace_emit(t, tr_loop, r.offset)->a = operands[0];
+			break;
+
+		case op_dot:
+		case op_define:
+			operands[0] = r.offset;
+			// fallthrough
+		default:
+		generic:
+			ins = trace_emit(t, tr_stub, r.offset);
+			ins->stub = stubs[r.op];
+			ins->a = operands[0];
+			ins->b = operands[1];
+		}
+	}
+
+	return t;
+}
+
+void trace_dispose(struct trace *t) {
+	if (t != NULL) {
+		free(t->insts);
+		free(t);
+	}
+}
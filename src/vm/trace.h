@@ -0,0 +1,76 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "jit.h"
+
+// Number of times a function has to loop through a self tail call
+// before its loop body is recorded, when tracing is enabled without an
+// explicit threshold.
+#define TRACE_THRESHOLD 50
+// Longest loop body recorded, in instructions.
+#define TRACE_MAX_LEN 512
+// Recording is given up for a function after this many aborts.
+#define TRACE_MAX_ABORTS 3
+
+struct function;
+
+// Instruction executed while recording with the types of the two values
+// on top of the stack before it.
+struct trace_rec {
+	uint32_t offset;
+	uint8_t op;
+	uint8_t types[2];
+	uint8_t taken; // whether the op_jump_not_truthy jumped
+};
+
+enum trace_op {
+	tr_const,
+	tr_get_local,
+	tr_set_local,
+	tr_get_global,
+	tr_pop,
+	tr_stub,
+	tr_add_int,
+	tr_sub_int,
+	tr_guard,
+	tr_guard_gt_int,
+	tr_guard_gte_int,
+	tr_loop
+};
+
+// The guards side exit to the interpreter at the exit offset when the
+// values don't have the recorded types or the branch goes the other way.
+// The typed operations check their operands before touching the stack,
+// while the branch guards exit once the condition was popped, so their
+// exit is the instruction the branch goes to instead. The fused integer
+// comparisons have both: exit for the types and b for the branch.
+struct trace_ins {
+	uint8_t op;
+	uint8_t flag; // tmp for the arithmetic, the expected condition for the guards
+	uint32_t a;
+	uint32_t b;
+	uint32_t exit;
+	jit_stub stub;
+};
+
+// Linear loop body of a function, from its entry to the self tail call
+// that jumps back to it.
+struct trace {
+	struct trace_ins *insts;
+	size_t len;
+};
+
+struct trace_stats {
+	uint64_t compiled;
+	uint64_t aborted;
+	uint64_t entered;
+	uint64_t side_exits;
+	uint64_t ns; // time spent running traces
+};
+
+struct trace *trace_compile(struct function *fn, struct trace_rec *recs, size_t len, const jit_stub *stubs);
+void trace_dispose(struct trace *t);
+
+#endif
@@ -1,13 +1,14 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "vm.h"
+#include "jit.h"
 #include "../obj/obj.h"
 #include "../code/code.h"
 
 #define vm_current_frame(vm) (&vm->frames[vm->frame_idx])
-#define vm_push_frame(vm, frame) vm->frames[++vm->frame_idx] = frame
 #define vm_pop_frame(vm) (&vm->frames[vm->frame_idx--])
 
 #define vm_stack_push(vm, obj) vm->stack[vm->sp++] = obj
@@ -15,7 +16,6 @@
 #define vm_stack_pop_ignore(vm) vm->sp--
 #define vm_stack_peek(vm) (vm->stack[vm->sp-1])
 
-#define DISPATCH() goto *jump_table[*frame->ip++]
 #define UNHANDLED() puts("unhandled opcode"); return -1
 
 #define ASSERT(obj, t) (obj->type == t)
@@ -23,78 +23,234 @@
 #define M_ASSERT(o1, o2, t) (ASSERT(o1, t) && ASSERT(o2, t))
 #define M_ASSERT2(o1, o2, t1, t2) (ASSERT2(o1, t1, t2) && ASSERT2(o2, t1, t2))
 
+static inline void stack_overflow_error() {
+	puts("stack overflow");
+	exit(1);
+}
+
+static void vm_stack_grow(struct vm * restrict vm, size_t n) {
+	size_t cap = vm->stack_cap;
+
+	while (vm->sp + n > cap) {
+		cap *= 2;
+	}
+	if (cap > STACK_MAX_SIZE) {
+		stack_overflow_error();
+	}
+	vm->stack = realloc(vm->stack, sizeof(struct object *) * cap);
+	vm->stack_cap = cap;
+
+	for (struct upvalue *uv = vm->open_upvalues; uv != NULL; uv = uv->next) {
+		uv->loc = &vm->stack[uv->slot];
+	}
+}
+
+// Makes sure the stack has room for n more values.
+// It's called once per frame with the locals and the maximum depth
+// computed by the compiler, so the pushes don't need to be checked.
+static inline void vm_stack_reserve(struct vm * restrict vm, size_t n) {
+	if (vm->sp + n > vm->stack_cap) {
+		vm_stack_grow(vm, n);
+	}
+}
+
+static inline void vm_push_frame(struct vm * restrict vm, struct frame frame) {
+	if (vm->frame_idx + 1 == vm->frames_cap) {
+		if (vm->frames_cap == MAX_FRAMES) {
+			stack_overflow_error();
+		}
+		vm->frames_cap *= 2;
+		vm->frames = realloc(vm->frames, sizeof(struct frame) * vm->frames_cap);
+	}
+	vm->frames[++vm->frame_idx] = frame;
+}
+
 static inline struct frame new_frame(struct object *cl, uint32_t base_ptr) {
 	return (struct frame) {
 		.cl = cl,
 		.base_ptr = base_ptr,
+		.tip = cl->data.cl->fn->threaded,
 		.ip = cl->data.cl->fn->instructions,
-		.start = cl->data.cl->fn->instructions
+		.start = cl->data.cl->fn->instructions,
+		.free = cl->data.cl->free
 	};
 }
 
 struct state new_state() {
+	struct symbol_table *st = new_symbol_table();
+	symbol_table_define_builtins(st);
+
 	return (struct state) {
-		.st = new_symbol_table(),
+		.st = st,
 		.consts = calloc(0, sizeof(struct object *)),
-		.nconsts = 0,
-		.globals = {0}
+		.nconsts = 0
 	};
 }
 
-struct vm *new_vm(struct bytecode bytecode) {
+static void state_reserve_globals(struct state *state, size_t n) {
+	if (n > state->globals_cap) {
+		size_t cap = state->globals_cap ? state->globals_cap : 16;
+		while (cap < n) cap *= 2;
+
+		state->globals = realloc(state->globals, sizeof(struct object *) * cap);
+		memset(&state->globals[state->globals_cap], 0, sizeof(struct object *) * (cap - state->globals_cap));
+		state->globals_cap = cap;
+	}
+	if (n > state->nglobals) {
+		state->nglobals = n;
+	}
+}
+
+static struct vm *alloc_vm() {
 	struct vm *vm = calloc(1, sizeof(struct vm));
-	vm->state.consts = bytecode.consts;
+	vm->stack = malloc(sizeof(struct object *) * STACK_MIN_SIZE);
+	vm->stack_cap = STACK_MIN_SIZE;
+	vm->frames = malloc(sizeof(struct frame) * FRAMES_MIN_SIZE);
+	vm->frames_cap = FRAMES_MIN_SIZE;
+
+	return vm;
+}
 
-	struct object *fn = new_function_obj(bytecode.insts, bytecode.len, 0, 0);
+struct vm *new_vm(struct bytecode bytecode) {
+	struct vm *vm = alloc_vm();
+	vm->state = &vm->local_state;
+	vm->state->consts = bytecode.consts;
+	vm->state->nconsts = bytecode.nconsts;
+	state_reserve_globals(vm->state, bytecode.nglobals);
+
+	struct object *fn = new_function_obj(bytecode.insts, bytecode.len, 0, 0, bytecode.max_stack);
 	struct object *cl = new_closure_obj(fn->data.fn, NULL, 0);
 	vm->frames[0] = new_frame(cl, 0);
+	vm_stack_reserve(vm, bytecode.max_stack);
 
 	return vm;
 }
 
-struct vm *new_vm_with_state(struct bytecode bytecode, struct state state) {
-	struct vm *vm = calloc(1, sizeof(struct vm));
+struct vm *new_vm_with_state(struct bytecode bytecode, struct state *state) {
+	struct vm *vm = alloc_vm();
 	vm->state = state;
+	state_reserve_globals(state, bytecode.nglobals);
 
-	struct object *fn = new_function_obj(bytecode.insts, bytecode.len, 0, 0);
+	struct object *fn = new_function_obj(bytecode.insts, bytecode.len, 0, 0, bytecode.max_stack);
 	struct object *cl = new_closure_obj(fn->data.fn, NULL, 0);
 	vm->frames[0] = new_frame(cl, 0);
+	vm_stack_reserve(vm, bytecode.max_stack);
 
 	return vm;
 }
 
+// The objects left on the stack aren't freed since they might still be
+// referenced by the globals or the constants shared with the next VM.
 void vm_dispose(struct vm *vm) {
-	for (size_t i = 0; i < STACK_SIZE; i++) {
-		if (vm->stack[i] != NULL) {
-			free(vm->stack[i]);
-		}
+	for (uint32_t i = 0; i < vm->region.nchunks; i++) {
+		free(vm->region.chunks[i]);
 	}
-
+	free(vm->region.chunks);
+	free(vm->stack);
+	free(vm->frames);
+	free(vm->local_state.globals);
 	free(vm);
 }
 
-static inline void vm_push_closure(struct vm *restrict vm, uint32_t const_idx, uint32_t num_free) {
-	struct object *cnst = vm->state.consts[const_idx];
+// Returns the open upvalue of the stack slot, creating it if no other
+// closure captured the slot yet.
+static inline struct upvalue *vm_capture_upvalue(struct vm * restrict vm, uint32_t slot) {
+	struct upvalue **next = &vm->open_upvalues;
+
+	while (*next != NULL && (*next)->slot > slot) {
+		next = &(*next)->next;
+	}
+	if (*next != NULL && (*next)->slot == slot) {
+		return *next;
+	}
+
+	struct upvalue *uv = malloc(sizeof(struct upvalue));
+	uv->loc = &vm->stack[slot];
+	uv->closed = NULL;
+	uv->slot = slot;
+	uv->next = *next;
+	*next = uv;
+
+	return uv;
+}
+
+// Closes the open upvalues of the slots from the given one upwards,
+// called when the frame that owns them goes away.
+static inline void vm_close_upvalues(struct vm * restrict vm, uint32_t slot) {
+	while (vm->open_upvalues != NULL && vm->open_upvalues->slot >= slot) {
+		struct upvalue *uv = vm->open_upvalues;
+		uv->closed = *uv->loc;
+		uv->loc = &uv->closed;
+		vm->open_upvalues = uv->next;
+	}
+}
+
+static inline struct object *vm_new_closure(struct vm *restrict vm, struct frame *frame, uint32_t const_idx) {
+	struct object *cnst = vm->state->consts[const_idx];
 
 	if (cnst->type != obj_function) {
-		printf("vm_push_closure: expected closure, but got %d\n", cnst->type);
+		printf("vm_new_closure: expected function, but got %s\n", otype_str(cnst->type));
 		exit(1);
 	}
-	
-	struct object **free = malloc(sizeof(struct object *) * num_free);
-	for (int i = 0; i < num_free; i++) {
-		free[i] = vm->stack[vm->sp-num_free+i];
+
+	struct function *fn = cnst->data.fn;
+	struct object *cl = new_closure_obj(fn, NULL, fn->num_free);
+	struct upvalue **free = cl->data.cl->free;
+
+	for (int i = 0; i < fn->num_free; i++) {
+		struct capture c = fn->captures[i];
+		free[i] = c.local ? vm_capture_upvalue(vm, frame->base_ptr + c.index) : frame->free[c.index];
 	}
+	return cl;
+}
 
-	struct object *cl = new_closure_obj(cnst->data.fn, free, num_free);
-	vm->sp -= num_free;
-	vm_stack_push(vm, cl);
+static void dispose_region_obj(struct object *o) {}
+
+static void vm_region_grow(struct vm * restrict vm) {
+	struct region *r = &vm->region;
+
+	r->chunks = realloc(r->chunks, sizeof(struct object *) * (r->nchunks + 1));
+	r->chunks[r->nchunks++] = malloc(sizeof(struct object) * REGION_CHUNK_SIZE);
+}
+
+static inline struct object *vm_region_alloc(struct vm * restrict vm) {
+	struct region *r = &vm->region;
+	uint32_t i = r->len++;
+
+	if (i == r->nchunks * REGION_CHUNK_SIZE) {
+		vm_region_grow(vm);
+	}
+	return &r->chunks[i / REGION_CHUNK_SIZE][i % REGION_CHUNK_SIZE];
+}
+
+// Allocates the result in the frame's region if tmp is set, or on the heap.
+static inline struct object *vm_new_integer(struct vm * restrict vm, int64_t i, int tmp) {
+	if (!tmp) {
+		return new_integer_obj(i);
+	}
+
+	struct object *o = vm_region_alloc(vm);
+	*o = (struct object) {
+		.data.i = i,
+		.type = obj_integer,
+		.dispose = dispose_region_obj,
+		.print = print_obj
+	};
+	return o;
 }
 
-static inline struct object *unwrap(struct object *o) {
-	if (o->type == obj_getsetter) {
-		// TODO: fill this.
+static inline struct object *vm_new_float(struct vm * restrict vm, double f, int tmp) {
+	if (!tmp) {
+		return new_float_obj(f);
 	}
+
+	struct object *o = vm_region_alloc(vm);
+	*o = (struct object) {
+		.data.f = f,
+		.type = obj_float,
+		.dispose = dispose_region_obj,
+		.print = print_obj
+	};
 	return o;
 }
 
@@ -130,199 +286,378 @@ static inline void unsupported_prefix_operator_error(char *op, struct object *o)
 	exit(1);
 }
 
-static inline void vm_exec_add(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
+// Returns the inline cache of the instruction at the offset.
+static inline struct inline_cache *vm_inline_cache(struct function *fn, size_t offset) {
+	if (fn->caches == NULL) {
+		fn->caches = calloc(fn->len, sizeof(struct inline_cache *));
+	}
+	if (fn->caches[offset] == NULL) {
+		fn->caches[offset] = calloc(1, sizeof(struct inline_cache));
+	}
+	return fn->caches[offset];
+}
+
+static inline void ic_add(struct inline_cache *ic, struct shape *shape, struct shape *next, struct object *name, uint32_t slot) {
+	if (ic->nentries == IC_SIZE) {
+		ic->megamorphic = 1;
+		return;
+	}
+	ic->entries[ic->nentries++] = (struct ic_entry) {.shape = shape, .next = next, .name = name, .slot = slot};
+}
 
+static inline int ic_same_name(struct ic_entry *e, struct object *name) {
+	return e->name == name || (e->name->len == name->len && memcmp(e->name->data.str, name->data.str, name->len) == 0);
+}
+
+static inline struct object *vm_exec_dot(struct inline_cache *ic, struct object *left, struct object *name) {
+	if (!ASSERT(left, obj_class)) {
+		printf("%s object has no attribute %.*s\n", otype_str(left->type), (int) name->len, name->data.str);
+		exit(1);
+	}
+
+	struct instance *inst = left->data.inst;
+	for (uint32_t i = 0; i < ic->nentries; i++) {
+		if (ic->entries[i].shape == inst->shape) {
+			ic->hits++;
+			return inst->fields[ic->entries[i].slot];
+		}
+	}
+
+	ic->misses++;
+	int slot = shape_lookup(inst->shape, name);
+	if (slot == -1) {
+		return null_obj;
+	}
+
+	if (!ic->megamorphic) {
+		ic_add(ic, inst->shape, NULL, name, slot);
+	}
+	return inst->fields[slot];
+}
+
+static inline void vm_class_set(struct inline_cache *ic, struct object *o, struct object *name, struct object *val) {
+	struct instance *inst = o->data.inst;
+
+	for (uint32_t i = 0; i < ic->nentries; i++) {
+		struct ic_entry *e = &ic->entries[i];
+
+		if (e->shape == inst->shape && ic_same_name(e, name)) {
+			ic->hits++;
+
+			if (e->next != NULL) {
+				class_reserve(o, e->next->nfields);
+				inst = o->data.inst;
+				inst->shape = e->next;
+			}
+			inst->fields[e->slot] = val;
+			return;
+		}
+	}
+
+	ic->misses++;
+	struct shape *shape = inst->shape;
+	int slot = class_set(o, name, val);
+
+	if (!ic->megamorphic) {
+		struct shape *next = o->data.inst->shape;
+		ic_add(ic, shape, next != shape ? next : NULL, name, slot);
+	}
+}
+
+static inline void unhashable_key_error(struct object *k) {
+	printf("invalid map key type %s\n", otype_str(k->type));
+	exit(1);
+}
+
+static inline struct object *vm_exec_map(struct object **elems, size_t nelems) {
+	struct object *map = new_map_obj(nelems / 2);
+
+	for (size_t i = 0; i < nelems; i += 2) {
+		struct object *key = elems[i];
+
+		if (!is_hashable(key)) {
+			unhashable_key_error(key);
+		}
+		map_set(map->data.map, key, elems[i+1]);
+	}
+	return map;
+}
+
+static inline int64_t list_index(struct object *list, struct object *index) {
+	if (!ASSERT(index, obj_integer)) {
+		printf("invalid list index type %s\n", otype_str(index->type));
+		exit(1);
+	}
+
+	int64_t i = index->data.i;
+	if (i < 0 || i >= list->len) {
+		printf("index %lld out of range for list of length %lu\n", (long long) i, list->len);
+		exit(1);
+	}
+	return i;
+}
+
+static inline struct object *vm_exec_index(struct object *left, struct object *index) {
+	switch (left->type) {
+	case obj_list:
+		return left->data.list[list_index(left, index)];
+
+	case obj_map: {
+		if (!is_hashable(index)) {
+			unhashable_key_error(index);
+		}
+		struct object *val = map_get(left->data.map, index);
+		return val != NULL ? val : null_obj;
+	}
+
+	default:
+		printf("invalid index operator for type %s\n", otype_str(left->type));
+		exit(1);
+	}
+}
+
+static inline struct object *vm_exec_define(struct function *fn, size_t offset, struct object *left, struct object *index, struct object *val) {
+	switch (left->type) {
+	case obj_list:
+		list_set(left, list_index(left, index), val);
+		break;
+
+	case obj_map:
+		if (!is_hashable(index)) {
+			unhashable_key_error(index);
+		}
+		map_set(left->data.map, index, val);
+		break;
+
+	case obj_class:
+		vm_class_set(vm_inline_cache(fn, offset), left, index, val);
+		break;
+
+	default:
+		printf("invalid index assignment for type %s\n", otype_str(left->type));
+		exit(1);
+	}
+	return val;
+}
+
+// Returns the length of the object once interpolated in a string.
+// The scratch buffer is used for the values that aren't formatted in-house.
+static inline size_t interpolated_len(struct object *o, char *scratch) {
+	switch (o->type) {
+	case obj_string:
+		return o->len;
+	case obj_integer:
+		return int_len(o->data.i);
+	case obj_float:
+		return format_float(scratch, o->data.f);
+	case obj_boolean:
+		return o->data.i ? 4 : 5;
+	case obj_null:
+		return 4;
+	default:
+		return snprintf(scratch, FLOAT_BUF_SIZE, "%s[%p]", otype_str(o->type), (void *) o);
+	}
+}
+
+static inline size_t write_interpolated(char *buf, struct object *o, char *scratch) {
+	switch (o->type) {
+	case obj_string:
+		memcpy(buf, o->data.str, o->len);
+		return o->len;
+	case obj_integer:
+		return format_int(buf, o->data.i);
+	case obj_float:
+		return format_float(buf, o->data.f);
+	case obj_boolean:
+		memcpy(buf, o->data.i ? "true" : "false", o->data.i ? 4 : 5);
+		return o->data.i ? 4 : 5;
+	case obj_null:
+		memcpy(buf, "null", 4);
+		return 4;
+	default: {
+		size_t len = snprintf(scratch, FLOAT_BUF_SIZE, "%s[%p]", otype_str(o->type), (void *) o);
+		memcpy(buf, scratch, len);
+		return len;
+	}
+	}
+}
+
+// Joins the nsubs values on the stack with the nsubs+1 literal parts in a
+// string allocated once with the exact size of the result.
+static inline struct object *vm_exec_interpolate(struct object **parts, struct object **subs, size_t nsubs) {
+	char scratch[FLOAT_BUF_SIZE];
+	size_t len = parts[0]->len;
+
+	for (size_t i = 0; i < nsubs; i++) {
+		len += interpolated_len(subs[i], scratch) + parts[i+1]->len;
+	}
+
+	struct object *res = new_string_with_len(len);
+	char *buf = res->data.str;
+
+	memcpy(buf, parts[0]->data.str, parts[0]->len);
+	buf += parts[0]->len;
+	for (size_t i = 0; i < nsubs; i++) {
+		buf += write_interpolated(buf, subs[i], scratch);
+		memcpy(buf, parts[i+1]->data.str, parts[i+1]->len);
+		buf += parts[i+1]->len;
+	}
+	return res;
+}
+
+static inline struct object *vm_exec_add(struct vm * restrict vm, struct object *left, struct object *right, int tmp) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, new_integer_obj(left->data.i + right->data.i));
+		return vm_new_integer(vm, left->data.i + right->data.i, tmp);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, new_float_obj(l + r));
+		return vm_new_float(vm, l + r, tmp);
 	} else if (M_ASSERT(left, right, obj_string)) {
-		puts("adding two strings is not yet supported!");
-		exit(1);
+		return string_concat(left, right);
 	} else {
 		puts("unsupported operator '+' for the two types");
 		exit(1);
 	}
 }
 
-static inline void vm_exec_sub(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_sub(struct vm * restrict vm, struct object *left, struct object *right, int tmp) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, new_integer_obj(left->data.i - right->data.i));
+		return vm_new_integer(vm, left->data.i - right->data.i, tmp);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, new_float_obj(l - r));
+		return vm_new_float(vm, l - r, tmp);
 	} else {
 		unsupported_operator_error("-", left, right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_mul(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_mul(struct object *left, struct object *right) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, new_integer_obj(left->data.i * right->data.i));
+		return new_integer_obj(left->data.i * right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, new_float_obj(l * r));
+		return new_float_obj(l * r);
 	} else {
 		unsupported_operator_error("*", left, right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_div(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_div(struct object *left, struct object *right) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, new_integer_obj(left->data.i / right->data.i));
+		return new_integer_obj(left->data.i / right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, new_float_obj(l / r));
+		return new_float_obj(l / r);
 	} else {
 		unsupported_operator_error("/", left, right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_mod(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_mod(struct object *left, struct object *right) {
 	if (!M_ASSERT(left, right, obj_integer)) {
 		unsupported_operator_error("%", left, right);
 	}
-	vm_stack_push(vm, new_integer_obj(left->data.i % right->data.i));
+	return new_integer_obj(left->data.i % right->data.i);
 }
 
-static inline void vm_exec_and(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
-	vm_stack_push(vm, parse_bool(is_truthy(left) && is_truthy(right)));
+static inline struct object *vm_exec_and(struct object *left, struct object *right) {
+	return parse_bool(is_truthy(left) && is_truthy(right));
 }
 
-static inline void vm_exec_or(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
-	vm_stack_push(vm, parse_bool(is_truthy(left) || is_truthy(right)));
+static inline struct object *vm_exec_or(struct object *left, struct object *right) {
+	return parse_bool(is_truthy(left) || is_truthy(right));
 }
 
-static inline void vm_exec_eq(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_eq(struct object *left, struct object *right) {
 	if (M_ASSERT2(left, right, obj_boolean, obj_null)) {
-		vm_stack_push(vm, parse_bool(left == right));
+		return parse_bool(left == right);
 	} else if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, parse_bool(left->data.i == right->data.i));
+		return parse_bool(left->data.i == right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, parse_bool(l == r));
+		return parse_bool(l == r);
 	} else if (M_ASSERT(left, right, obj_string)) {
-		char *l = left->data.str;
-		char *r = right->data.str;
-		struct object *res = left->len == right->len ? parse_bool(strcmp(l, r) == 0) : false_obj;
-		vm_stack_push(vm, res);
+		struct object *res = left->len == right->len ? parse_bool(string_cmp(left, right) == 0) : false_obj;
+		return res;
 	} else {
-		vm_stack_push(vm, false_obj);
+		return false_obj;
 	}
 }
 
-static inline void vm_exec_not_eq(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_not_eq(struct object *left, struct object *right) {
 	if (M_ASSERT2(left, right, obj_boolean, obj_null)) {
-		vm_stack_push(vm, parse_bool(left != right));
+		return parse_bool(left != right);
 	} else if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, parse_bool(left->data.i != right->data.i));
+		return parse_bool(left->data.i != right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, parse_bool(l != r));
+		return parse_bool(l != r);
 	} else if (M_ASSERT(left, right, obj_string)) {
-		char *l = left->data.str;
-		char *r = right->data.str;
-		struct object *res = left->len == right->len ? parse_bool(strcmp(l, r) != 0) : false_obj;
-		vm_stack_push(vm, res);
+		struct object *res = left->len == right->len ? parse_bool(string_cmp(left, right) != 0) : true_obj;
+		return res;
 	} else {
-		vm_stack_push(vm, false_obj);
+		return false_obj;
 	}
 }
 
-static inline void vm_exec_greater_than(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_greater_than(struct object *left, struct object *right) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, parse_bool(left->data.i > right->data.i));
+		return parse_bool(left->data.i > right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, parse_bool(l > r));
+		return parse_bool(l > r);
 	} else if (M_ASSERT(left, right, obj_string)) {
-		char *l = left->data.str;
-		char *r = right->data.str;
-		vm_stack_push(vm, parse_bool(strcmp(l, r) > 0));
+		return parse_bool(string_cmp(left, right) > 0);
 	} else {
 		unsupported_operator_error(">", left, right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_greater_than_eq(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-	struct object *left = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_greater_than_eq(struct object *left, struct object *right) {
 	if (M_ASSERT(left, right, obj_integer)) {
-		vm_stack_push(vm, parse_bool(left->data.i >= right->data.i));
+		return parse_bool(left->data.i >= right->data.i);
 	} else if (M_ASSERT2(left, right, obj_integer, obj_float)) {
 		double l = to_double(left);
 		double r = to_double(right);
-		vm_stack_push(vm, parse_bool(l >= r));
+		return parse_bool(l >= r);
 	} else if (M_ASSERT(left, right, obj_string)) {
-		char *l = left->data.str;
-		char *r = right->data.str;
-		vm_stack_push(vm, parse_bool(strcmp(l, r) >= 0));
+		return parse_bool(string_cmp(left, right) >= 0);
 	} else {
 		unsupported_operator_error(">", left, right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_minus(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_minus(struct object *right) {
 	switch (right->type) {
 	case obj_integer:
-		vm_stack_push(vm, new_integer_obj(-right->data.i));
+		return new_integer_obj(-right->data.i);
 	case obj_float:
-		vm_stack_push(vm, new_float_obj(-right->data.f));
+		return new_float_obj(-right->data.f);
 	default:
 		unsupported_prefix_operator_error("-", right);
+		return NULL;
 	}
 }
 
-static inline void vm_exec_bang(struct vm * restrict vm) {
-	struct object *right = unwrap(vm_stack_pop(vm));
-
+static inline struct object *vm_exec_bang(struct object *right) {
 	switch (right->type) {
 	case obj_boolean:
-		vm_stack_push(vm, parse_bool(!right->data.i));
+		return parse_bool(!right->data.i);
 	case obj_null:
-		vm_stack_push(vm, true_obj);
+		return true_obj;
 	default:
-		vm_stack_push(vm, false_obj);
+		return false_obj;
 	}
 }
 
@@ -335,19 +670,30 @@ static inline void vm_call_closure(struct vm * restrict vm, struct object *cl, s
 	}
 
 	struct frame frame = new_frame(cl, vm->sp-numargs);
+	frame.region_mark = vm->region.len;
 	vm_push_frame(vm, frame);
+	vm_stack_reserve(vm, cl->data.cl->fn->num_locals + cl->data.cl->fn->max_stack);
 	vm->sp = frame.base_ptr + cl->data.cl->fn->num_locals;
 }
 
+// The builtin reads its arguments straight from the stack and its
+// result replaces the callee.
+static inline void vm_call_builtin(struct vm * restrict vm, struct object *fn, size_t numargs) {
+	struct object **args = &vm->stack[vm->sp-numargs];
+	struct object *res = fn->data.builtin(args, numargs);
+
+	vm->sp -= numargs + 1;
+	vm_stack_push(vm, res);
+}
+
 static inline void vm_exec_call(struct vm * restrict vm, size_t numargs) {
-	struct object *o = unwrap(vm->stack[vm->sp-1-numargs]);
+	struct object *o = vm->stack[vm->sp-1-numargs];
 
 	switch (o->type) {
 	case obj_closure:
 		return vm_call_closure(vm, o, numargs);
 	case obj_builtin:
-		puts("calling builtins is not yet supported");
-		exit(1);
+		return vm_call_builtin(vm, o, numargs);
 	default:
 		puts("calling non-function");
 		exit(1);
@@ -356,21 +702,515 @@ static inline void vm_exec_call(struct vm * restrict vm, size_t numargs) {
 
 static inline void vm_exec_return(struct vm * restrict vm) {
 	struct frame *frame = vm_pop_frame(vm);
+	vm_close_upvalues(vm, frame->base_ptr);
+	vm->region.len = frame->region_mark;
 	vm->sp = frame->base_ptr - 1;
 	vm_stack_push(vm, null_obj);
 }
 
 static inline void vm_exec_return_value(struct vm * restrict vm) {
-	struct object *o = unwrap(vm_stack_pop(vm));
+	struct object *o = vm_stack_pop(vm);
 	struct frame *frame = vm_pop_frame(vm);
+	vm_close_upvalues(vm, frame->base_ptr);
+	vm->region.len = frame->region_mark;
 	vm->sp = frame->base_ptr - 1;
 	vm_stack_push(vm, o);
 }
 
+// Replaces the current frame with the one of the called closure: the
+// callee and its arguments are moved where the caller's were and the
+// frame is reused, so tail recursion runs in constant space.
+static inline void vm_exec_tail_call(struct vm * restrict vm, struct frame *frame, size_t numargs) {
+	struct object *o = vm->stack[vm->sp-1-numargs];
+
+	if (o->type != obj_closure) {
+		vm_exec_call(vm, numargs);
+		return vm_exec_return_value(vm);
+	}
+
+	int num_params = o->data.cl->fn->num_params;
+	if (num_params != numargs) {
+		printf("wrong number of arguments: expected %d, got %lu\n", num_params, numargs);
+		exit(1);
+	}
+
+	vm_close_upvalues(vm, frame->base_ptr);
+	memmove(&vm->stack[frame->base_ptr-1], &vm->stack[vm->sp-1-numargs], sizeof(struct object *) * (numargs + 1));
+	uint32_t region_mark = frame->region_mark;
+	*frame = new_frame(o, frame->base_ptr);
+	frame->region_mark = region_mark;
+	vm->region.len = region_mark;
+	vm->sp = frame->base_ptr;
+	vm_stack_reserve(vm, o->data.cl->fn->num_locals + o->data.cl->fn->max_stack);
+	vm->sp += o->data.cl->fn->num_locals;
+}
+
+static void print_inline_caches(struct function *fn) {
+	if (fn->caches == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < fn->len; i++) {
+		struct inline_cache *ic = fn->caches[i];
+
+		if (ic != NULL) {
+			char *state = ic->megamorphic ? "megamorphic" : ic->nentries > 1 ? "polymorphic" : "monomorphic";
+			printf("function[%p]+%04lu %s: %s %lu hits, %lu misses\n",
+				(void *) fn, i, opcode_str(fn->instructions[i]), state, ic->hits, ic->misses);
+		}
+	}
+}
+
+// Prints the hit and miss counters of every field access site.
+void vm_print_inline_caches(struct vm *vm) {
+	print_inline_caches(vm->frames[0].cl->data.cl->fn);
+
+	for (size_t i = 0; i < vm->state->nconsts; i++) {
+		struct object *o = vm->state->consts[i];
+
+		if (o->type == obj_function) {
+			print_inline_caches(o->data.fn);
+		} else if (o->type == obj_closure) {
+			print_inline_caches(o->data.cl->fn);
+		}
+	}
+}
+
+void vm_print_trace_stats(struct vm *vm) {
+	struct trace_stats *ts = &vm->trace_stats;
+	printf("traces: %lu compiled, %lu aborted, %lu entered, %lu side exits, %.3f ms in traces\n",
+		ts->compiled, ts->aborted, ts->entered, ts->side_exits, ts->ns / 1e6);
+}
+
 struct object *vm_last_popped_stack_elem(struct vm * restrict vm) {
 	return vm->stack[vm->sp];
 }
 
+// Handlers called by the native code of the baseline JIT. They're the
+// interpreter's handlers of the same opcodes behind a common signature.
+#define JIT_STUB(name) \
+	static uintptr_t jit_##name(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b)
+
+// The operators' stubs replace the operands on top of the stack with
+// the result of the expression.
+#define BINARY_STUB(name, expr) \
+	JIT_STUB(name) { \
+		struct object *right = vm_stack_pop(vm); \
+		struct object *left = vm_stack_pop(vm); \
+		vm_stack_push(vm, expr); \
+		return 0; \
+	}
+
+JIT_STUB(true) { vm_stack_push(vm, true_obj); return 0; }
+JIT_STUB(false) { vm_stack_push(vm, false_obj); return 0; }
+JIT_STUB(null) { vm_stack_push(vm, null_obj); return 0; }
+JIT_STUB(current_closure) { vm_stack_push(vm, frame->cl); return 0; }
+BINARY_STUB(add, vm_exec_add(vm, left, right, 0))
+BINARY_STUB(sub, vm_exec_sub(vm, left, right, 0))
+BINARY_STUB(mul, vm_exec_mul(left, right))
+BINARY_STUB(div, vm_exec_div(left, right))
+BINARY_STUB(mod, vm_exec_mod(left, right))
+BINARY_STUB(add_tmp, vm_exec_add(vm, left, right, 1))
+BINARY_STUB(sub_tmp, vm_exec_sub(vm, left, right, 1))
+BINARY_STUB(and, vm_exec_and(left, right))
+BINARY_STUB(or, vm_exec_or(left, right))
+BINARY_STUB(equal, vm_exec_eq(left, right))
+BINARY_STUB(not_equal, vm_exec_not_eq(left, right))
+BINARY_STUB(greater_than, vm_exec_greater_than(left, right))
+BINARY_STUB(greater_than_equal, vm_exec_greater_than_eq(left, right))
+BINARY_STUB(index, vm_exec_index(left, right))
+BINARY_STUB(dot, vm_exec_dot(vm_inline_cache(frame->cl->data.cl->fn, a), left, right))
+JIT_STUB(minus) { vm->stack[vm->sp-1] = vm_exec_minus(vm->stack[vm->sp-1]); return 0; }
+JIT_STUB(bang) { vm->stack[vm->sp-1] = vm_exec_bang(vm->stack[vm->sp-1]); return 0; }
+JIT_STUB(set_global) { vm->state->globals[a] = vm_stack_peek(vm); return 0; }
+JIT_STUB(get_builtin) { vm_stack_push(vm, builtins[a].obj); return 0; }
+JIT_STUB(get_free) { vm_stack_push(vm, *frame->free[a]->loc); return 0; }
+JIT_STUB(set_free) { *frame->free[a]->loc = vm_stack_peek(vm); return 0; }
+JIT_STUB(jump_not_truthy) { return is_truthy(vm_stack_pop(vm)); }
+
+JIT_STUB(closure) {
+	struct object *cl = vm_new_closure(vm, frame, a);
+	vm_stack_push(vm, cl);
+	return 0;
+}
+
+JIT_STUB(list) {
+	struct object *list = new_list_obj(&vm->stack[vm->sp-a], a);
+	vm->sp -= a;
+	vm_stack_push(vm, list);
+	return 0;
+}
+
+JIT_STUB(map) {
+	struct object *map = vm_exec_map(&vm->stack[vm->sp-a], a);
+	vm->sp -= a;
+	vm_stack_push(vm, map);
+	return 0;
+}
+
+JIT_STUB(define) {
+	struct object *val = vm_stack_pop(vm);
+	struct object *index = vm_stack_pop(vm);
+	struct object *left = vm_stack_pop(vm);
+	vm_stack_push(vm, vm_exec_define(frame->cl->data.cl->fn, a, left, index, val));
+	return 0;
+}
+
+JIT_STUB(interpolate) {
+	struct object *res = vm_exec_interpolate(&vm->state->consts[a], &vm->stack[vm->sp-b], b);
+	vm->sp -= b;
+	vm_stack_push(vm, res);
+	return 0;
+}
+
+JIT_STUB(call_builtin) {
+	struct object **args = &vm->stack[vm->sp-b];
+	struct object *res = builtins[a].obj->data.builtin(args, b);
+	vm->sp -= b;
+	vm_stack_push(vm, res);
+	return 0;
+}
+
+#undef JIT_STUB
+#undef BINARY_STUB
+
+// The opcodes without a handler are side exits to the interpreter.
+static const jit_stub jit_stubs[NUM_OPCODES] = {
+	[op_true] = jit_true,
+	[op_false] = jit_false,
+	[op_null] = jit_null,
+	[op_list] = jit_list,
+	[op_map] = jit_map,
+	[op_closure] = jit_closure,
+	[op_current_closure] = jit_current_closure,
+	[op_add] = jit_add,
+	[op_sub] = jit_sub,
+	[op_mul] = jit_mul,
+	[op_div] = jit_div,
+	[op_mod] = jit_mod,
+	[op_add_tmp] = jit_add_tmp,
+	[op_sub_tmp] = jit_sub_tmp,
+	[op_bw_and] = jit_and,
+	[op_bw_or] = jit_or,
+	[op_and] = jit_and,
+	[op_or] = jit_or,
+	[op_equal] = jit_equal,
+	[op_not_equal] = jit_not_equal,
+	[op_greater_than] = jit_greater_than,
+	[op_greater_than_equal] = jit_greater_than_equal,
+	[op_minus] = jit_minus,
+	[op_bang] = jit_bang,
+	[op_index] = jit_index,
+	[op_call_builtin] = jit_call_builtin,
+	[op_jump_not_truthy] = jit_jump_not_truthy,
+	[op_dot] = jit_dot,
+	[op_define] = jit_define,
+	[op_set_global] = jit_set_global,
+	[op_get_builtin] = jit_get_builtin,
+	[op_get_free] = jit_get_free,
+	[op_set_free] = jit_set_free,
+	[op_interpolate] = jit_interpolate,
+};
+
+static inline int vm_jit_frame(struct vm * restrict vm, uint32_t idx);
+
+// The call runs a compiled callee natively too, leaving it to the
+// interpreter when its code exits before returning.
+static uintptr_t jit_call(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b) {
+	struct object *o = vm->stack[vm->sp-1-a];
+
+	if (o->type != obj_closure) {
+		vm_exec_call(vm, a);
+		return (uintptr_t) vm_current_frame(vm);
+	}
+
+	frame->ip = frame->start + b;
+	vm_call_closure(vm, o, a);
+	uint32_t idx = vm->frame_idx;
+	if (vm->jit_depth >= JIT_MAX_DEPTH || !vm_jit_frame(vm, idx)) {
+		return 0;
+	}
+	return (uintptr_t) &vm->frames[idx-1];
+}
+
+// Only a call of the same function stays in the native code, as a loop.
+static uintptr_t jit_tail_call(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b) {
+	struct object *o = vm->stack[vm->sp-1-a];
+
+	if (o->type != obj_closure || o->data.cl->fn != frame->cl->data.cl->fn) {
+		return 0;
+	}
+	vm_exec_tail_call(vm, frame, a);
+	return 1;
+}
+
+static uintptr_t jit_return(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b) {
+	vm_exec_return(vm);
+	return 0;
+}
+
+static uintptr_t jit_return_value(struct vm *vm, struct frame *frame, uintptr_t a, uintptr_t b) {
+	vm_exec_return_value(vm);
+	return 0;
+}
+
+static const struct jit_calls jit_calls = {
+	.call = jit_call,
+	.tail_call = jit_tail_call,
+	.ret = jit_return,
+	.return_value = jit_return_value,
+};
+
+// Runs the function of the frame at idx natively from its current
+// instruction if it's compiled, compiling it first when the call crosses
+// the threshold. It returns whether the function returned, otherwise the
+// frame's ip is left at the instruction of the side exit.
+static inline int vm_jit_frame(struct vm * restrict vm, uint32_t idx) {
+	struct frame *frame = &vm->frames[idx];
+	struct function *fn = frame->cl->data.cl->fn;
+
+	if (fn->jit == NULL) {
+		if (frame->ip != frame->start || ++fn->calls < vm->jit_threshold) {
+			return 0;
+		}
+		fn->jit = jit_compile(fn, jit_stubs, &jit_calls);
+		if (fn->jit == NULL) {
+			return 0;
+		}
+	}
+
+	vm->jit_depth++;
+	size_t offset = jit_run(fn->jit, vm, frame, frame->ip - frame->start);
+	vm->jit_depth--;
+	if (offset == JIT_RETURNED) {
+		return 1;
+	}
+	// The native calls can have moved the frames.
+	frame = &vm->frames[idx];
+	frame->ip = frame->start + offset;
+	return 0;
+}
+
+// Runs the current frame natively, and the callers it returns to, until
+// a side exit. It returns the frame the interpreter has to resume.
+static struct frame *vm_jit_enter(struct vm * restrict vm) {
+	while (vm_jit_frame(vm, vm->frame_idx));
+	return vm_current_frame(vm);
+}
+
+// Decodes the operands of the instruction at ip.
+static inline void vm_read_operands(uint8_t *ip, uintptr_t operands[2]) {
+	struct definition def = definitions[*ip];
+	size_t off = 1;
+
+	for (int i = 0; i < def.noperands; i++) {
+		operands[i] = def.opwidths[i] == 2 ? read_uint16(&ip[off]) : read_uint8(&ip[off]);
+		off += def.opwidths[i];
+	}
+}
+
+// Executes one iteration of the frame's loop recording the instructions
+// and the types they see, and compiles the trace once the iteration
+// ends with the tail call back to the start. Recording is given up at
+// the first instruction a trace can't contain, which is left for the
+// interpreter to execute.
+static struct trace *vm_trace_record(struct vm * restrict vm, struct frame *frame) {
+	struct trace_rec *recs = malloc(sizeof(struct trace_rec) * TRACE_MAX_LEN);
+	struct trace *t = NULL;
+	size_t len = 0;
+
+	while (len < TRACE_MAX_LEN) {
+		uint8_t *ip = frame->ip;
+		uintptr_t operands[2] = {0};
+		struct trace_rec *r = &recs[len++];
+
+		*r = (struct trace_rec) {.offset = ip - frame->start, .op = *ip};
+		vm_read_operands(ip, operands);
+
+		switch (*ip) {
+		case op_constant:
+			vm_stack_push(vm, vm->state->consts[operands[0]]);
+			break;
+		case op_get_local:
+			vm_stack_push(vm, vm->stack[frame->base_ptr+operands[0]]);
+			break;
+		case op_set_local:
+			vm->stack[frame->base_ptr+operands[0]] = vm_stack_peek(vm);
+			break;
+		case op_get_global:
+			vm_stack_push(vm, vm->state->globals[operands[0]]);
+			break;
+		case op_pop:
+			vm_stack_pop_ignore(vm);
+			break;
+		case op_jump:
+			frame->ip = &frame->start[operands[0]];
+			continue;
+		case op_jump_not_truthy:
+			r->taken = !jit_stubs[op_jump_not_truthy](vm, frame, 0, 0);
+			if (r->taken) {
+				frame->ip = &frame->start[operands[0]];
+				continue;
+			}
+			break;
+
+		case op_tail_call:
+			if (vm->stack[vm->sp-1-operands[0]] != frame->cl) {
+				goto done;
+			}
+			vm_exec_tail_call(vm, frame, operands[0]);
+			t = trace_compile(frame->cl->data.cl->fn, recs, len, jit_stubs);
+			goto done;
+
+		case op_add:
+		case op_sub:
+		case op_add_tmp:
+		case op_sub_tmp:
+		case op_greater_than:
+		case op_greater_than_equal:
+			r->types[0] = vm->stack[vm->sp-2]->type;
+			r->types[1] = vm->stack[vm->sp-1]->type;
+			// fallthrough
+		default:
+			if (jit_stubs[*ip] == NULL) {
+				goto done;
+			}
+			if (*ip == op_dot || *ip == op_define) {
+				operands[0] = r->offset;
+			}
+			jit_stubs[*ip](vm, frame, operands[0], operands[1]);
+		}
+		frame->ip = ip + instruction_len(*ip);
+	}
+
+done:
+	free(recs);
+	return t;
+}
+
+// Runs the trace until a guard fails, leaving the frame's ip at the
+// instruction the interpreter resumes from.
+static void vm_trace_run(struct vm * restrict vm, struct frame *frame, struct trace *t) {
+	int num_locals = frame->cl->data.cl->fn->num_locals;
+	struct trace_ins *ins = t->insts;
+	uint32_t exit;
+
+	for (;; ins++) {
+		switch (ins->op) {
+		case tr_const:
+			vm_stack_push(vm, vm->state->consts[ins->a]);
+			break;
+		case tr_get_local:
+			vm_stack_push(vm, vm->stack[frame->base_ptr+ins->a]);
+			break;
+		case tr_set_local:
+			vm->stack[frame->base_ptr+ins->a] = vm_stack_peek(vm);
+			break;
+		case tr_get_global:
+			vm_stack_push(vm, vm->state->globals[ins->a]);
+			break;
+		case tr_pop:
+			vm_stack_pop_ignore(vm);
+			break;
+		case tr_stub:
+			ins->stub(vm, frame, ins->a, ins->b);
+			break;
+
+		case tr_add_int:
+		case tr_sub_int: {
+			struct object *left = vm->stack[vm->sp-2];
+			struct object *right = vm->stack[vm->sp-1];
+
+			if (!M_ASSERT(left, right, obj_integer)) {
+				exit = ins->exit;
+				goto side_exit;
+			}
+			int64_t res = ins->op == tr_add_int ? left->data.i + right->data.i : left->data.i - right->data.i;
+			vm->sp -= 2;
+			vm_stack_push(vm, vm_new_integer(vm, res, ins->flag));
+			break;
+		}
+
+		case tr_guard_gt_int:
+		case tr_guard_gte_int: {
+			struct object *left = vm->stack[vm->sp-2];
+			struct object *right = vm->stack[vm->sp-1];
+
+			if (!M_ASSERT(left, right, obj_integer)) {
+				exit = ins->exit;
+				goto side_exit;
+			}
+			vm->sp -= 2;
+			int cond = ins->op == tr_guard_gt_int ? left->data.i > right->data.i : left->data.i >= right->data.i;
+			if (cond != ins->flag) {
+				exit = ins->b;
+				goto side_exit;
+			}
+			break;
+		}
+
+		case tr_guard:
+			if (!ins->stub(vm, frame, 0, 0) != !ins->flag) {
+				exit = ins->exit;
+				goto side_exit;
+			}
+			break;
+
+		// Same as the tail call, but the callee is already in place.
+		case tr_loop: {
+			uint32_t numargs = ins->a;
+
+			if (vm->stack[vm->sp-1-numargs] != frame->cl) {
+				exit = ins->exit;
+				goto side_exit;
+			}
+			vm_close_upvalues(vm, frame->base_ptr);
+			memmove(&vm->stack[frame->base_ptr], &vm->stack[vm->sp-numargs], sizeof(struct object *) * numargs);
+			vm->region.len = frame->region_mark;
+			vm->sp = frame->base_ptr + num_locals;
+			ins = t->insts - 1;
+			break;
+		}
+		}
+	}
+
+side_exit:
+	vm->trace_stats.side_exits++;
+	frame->ip = &frame->start[exit];
+}
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Called when the frame's function jumped back to its start with a tail
+// call. Once it did so often enough its loop is recorded, and from then
+// on the trace runs instead of the interpreter.
+static void vm_trace_loop(struct vm * restrict vm, struct frame *frame) {
+	struct function *fn = frame->cl->data.cl->fn;
+
+	if (fn->trace == NULL) {
+		if (fn->trace_aborts >= TRACE_MAX_ABORTS || ++fn->loops < vm->trace_threshold) {
+			return;
+		}
+		fn->loops = 0;
+		fn->trace = vm_trace_record(vm, frame);
+		if (fn->trace == NULL) {
+			fn->trace_aborts++;
+			vm->trace_stats.aborted++;
+			return;
+		}
+		vm->trace_stats.compiled++;
+	}
+
+	uint64_t start = now_ns();
+	vm->trace_stats.entered++;
+	vm_trace_run(vm, frame, fn->trace);
+	vm->trace_stats.ns += now_ns() - start;
+}
+
 /*
  * The following comment is taken from CPython's source:
  * https://github.com/python/cpython/blob/3.11/Python/ceval.c#L1243
@@ -410,261 +1250,323 @@ struct object *vm_last_popped_stack_elem(struct vm * restrict vm) {
  * -fno-crossjumping).
  */
 
-int vm_run(struct vm * restrict vm) {
-#include "jump_table.h"
-
-	register struct frame *frame = vm_current_frame(vm);
-	DISPATCH();
-
-	TARGET_CONST: {
-		uint16_t idx = read_uint16(frame->ip);
-		frame->ip += 2;
-		vm_stack_push(vm, vm->state.consts[idx]);
-		DISPATCH();
-	}
-
-	TARGET_TRUE: {
-		vm_stack_push(vm, true_obj);
-		DISPATCH();
-	}
-
-	TARGET_FALSE: {
-		vm_stack_push(vm, false_obj);
-		DISPATCH();
-	}
-
-	TARGET_NULL: {
-		vm_stack_push(vm, null_obj);
-		DISPATCH();
-	}
-
-	TARGET_LIST: {
-		UNHANDLED();
-		DISPATCH();
-	}
-
-	TARGET_MAP: {
-		UNHANDLED();
-		DISPATCH();
-	}
-
-	TARGET_CLOSURE: {
-		uint16_t const_idx = read_uint16(frame->ip);
-		uint8_t num_free = read_uint8(frame->ip+2);
-		frame->ip += 3;
-		vm_push_closure(vm, const_idx, num_free);
-		DISPATCH();
-	}
-
-	TARGET_CURRENT_CLOSURE: {
-		vm_stack_push(vm, frame->cl);
-		DISPATCH();
-	}
+/*
+ * Both loops keep the instruction pointer, the top of the value stack and
+ * the base of the frame's locals in local variables, so that they live in
+ * registers. The stack is only handled through them in the handlers, and
+ * they're written back to the VM and the frame before calling what uses
+ * the ones there, the calls and the returns, and read again after.
+ */
 
-	TARGET_ADD: {
-		vm_exec_add(vm);
-		DISPATCH();
-	}
+#define PUSH(o) (*sp++ = (o))
+#define POP() (*--sp)
+#define PEEK() (sp[-1])
+#define SAVE_STATE() vm->sp = sp - vm->stack; SAVE_IP()
+#define LOAD_STATE() \
+	sp = &vm->stack[vm->sp]; \
+	bp = &vm->stack[frame->base_ptr]; \
+	LOAD_IP()
+
+#define OPERAND8() read_uint8(ip++)
+#define OPERAND16() (ip += 2, read_uint16(ip-2))
+#define JUMP(pos) ip = &frame->start[pos]
+#define INSTR_OFFSET() (ip - frame->start - 1)
+#define SAVE_IP() frame->ip = ip
+#define LOAD_IP() ip = frame->ip
+#define LOAD_FRAME() \
+	frame = vm_current_frame(vm); \
+	if (vm->jit_threshold) frame = vm_jit_enter(vm); \
+	LOAD_STATE()
+#define LOOP_HEADER() if (vm->trace_threshold) vm_trace_loop(vm, frame)
+
+#ifdef TAU_PROFILE
 
-	TARGET_SUB: {
-		vm_exec_sub(vm);
-		DISPATCH();
-	}
+/*
+ * Built with make PROFILE=1, vm_run counts the instructions it executes
+ * by opcode and by pair of consecutive opcodes, and the time spent in
+ * each handler, from one dispatch to the next. The time is in cycles of
+ * the timestamp counter where there's one and in nanoseconds elsewhere.
+ * The report is printed on stderr at exit.
+ */
 
-	TARGET_MUL: {
-		vm_exec_mul(vm);
-		DISPATCH();
-	}
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CLOCK() __rdtsc()
+#define PROFILE_UNIT "cycles"
+#else
+static inline uint64_t profile_clock() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define PROFILE_CLOCK() profile_clock()
+#define PROFILE_UNIT "ns"
+#endif
+
+#define PROFILE_TOP_PAIRS 30
+
+static struct {
+	uint64_t counts[NUM_OPCODES];
+	uint64_t pairs[NUM_OPCODES][NUM_OPCODES];
+	uint64_t time[NUM_OPCODES];
+	uint64_t start;
+	int last; // opcode being executed, NUM_OPCODES if none
+	int registered;
+} profile;
+
+struct profile_entry {
+	uint64_t count;
+	int op;
+	int next;
+};
+
+static int cmp_profile_entry(const void *a, const void *b) {
+	uint64_t x = ((struct profile_entry *) a)->count;
+	uint64_t y = ((struct profile_entry *) b)->count;
+	return (x < y) - (x > y);
+}
 
-	TARGET_DIV: {
-		vm_exec_div(vm);
-		DISPATCH();
+static void vm_profile_report() {
+	struct profile_entry ops[NUM_OPCODES];
+	struct profile_entry *pairs = malloc(sizeof(struct profile_entry) * NUM_OPCODES * NUM_OPCODES);
+	uint64_t total = 0, total_time = 0, total_pairs = 0;
+	size_t nops = 0, npairs = 0;
+
+	for (int i = 0; i < NUM_OPCODES; i++) {
+		total += profile.counts[i];
+		total_time += profile.time[i];
+		if (profile.counts[i] > 0) {
+			ops[nops++] = (struct profile_entry) {profile.counts[i], i, 0};
+		}
+		for (int j = 0; j < NUM_OPCODES; j++) {
+			total_pairs += profile.pairs[i][j];
+			if (profile.pairs[i][j] > 0) {
+				pairs[npairs++] = (struct profile_entry) {profile.pairs[i][j], i, j};
+			}
+		}
 	}
+	qsort(ops, nops, sizeof(struct profile_entry), cmp_profile_entry);
+	qsort(pairs, npairs, sizeof(struct profile_entry), cmp_profile_entry);
+
+	fprintf(stderr, "\n%-24s %14s %7s %16s %7s %10s\n", "opcode", "count", "%", PROFILE_UNIT, "%", "per exec");
+	for (size_t i = 0; i < nops; i++) {
+		int op = ops[i].op;
+		fprintf(stderr, "%-24s %14lu %6.2f%% %16lu %6.2f%% %10.1f\n",
+			opcode_str(op),
+			profile.counts[op],
+			100.0 * profile.counts[op] / total,
+			profile.time[op],
+			total_time ? 100.0 * profile.time[op] / total_time : 0.0,
+			(double) profile.time[op] / profile.counts[op]);
+	}
+	fprintf(stderr, "%-24s %14lu %7s %16lu\n", "total", total, "", total_time);
+
+	fprintf(stderr, "\n%-49s %14s %7s\n", "pair", "count", "%");
+	for (size_t i = 0; i < npairs && i < PROFILE_TOP_PAIRS; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s -> %s", opcode_str(pairs[i].op), opcode_str(pairs[i].next));
+		fprintf(stderr, "%-49s %14lu %6.2f%%\n", name, pairs[i].count, 100.0 * pairs[i].count / total_pairs);
+	}
+	free(pairs);
+}
 
-	TARGET_MOD: {
-		vm_exec_mod(vm);
-		DISPATCH();
+static inline void vm_profile_enter() {
+	if (!profile.registered) {
+		atexit(vm_profile_report);
+		profile.registered = 1;
 	}
+	profile.last = NUM_OPCODES;
+}
 
-	TARGET_BW_AND: {
-		vm_exec_and(vm);
-		DISPATCH();
-	}
+// Called by each dispatch with the opcode it's about to execute.
+static inline void vm_profile_op(uint8_t op) {
+	uint64_t now = PROFILE_CLOCK();
 
-	TARGET_BW_OR: {
-		vm_exec_or(vm);
-		DISPATCH();
+	if (profile.last != NUM_OPCODES) {
+		profile.time[profile.last] += now - profile.start;
+		profile.pairs[profile.last][op]++;
 	}
+	profile.counts[op]++;
+	profile.last = op;
+	profile.start = now;
+}
 
-	TARGET_BW_XOR: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#define PROFILE_ENTER() vm_profile_enter()
+#define PROFILE_OP(op) vm_profile_op(op)
 
-	TARGET_BW_NOT: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#else
 
-	TARGET_BW_LSHIFT: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#define PROFILE_ENTER()
+#define PROFILE_OP(op)
 
-	TARGET_BW_RSHIFT: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#endif
 
-	TARGET_AND: {
-		vm_exec_and(vm);
-		DISPATCH();
-	}
+#ifdef TAU_TAILCALL
 
-	TARGET_OR: {
-		vm_exec_or(vm);
-		DISPATCH();
-	}
+/*
+ * Each handler is a function that ends by tail-calling the next one with
+ * the interpreter's state as arguments, so that the compiler allocates
+ * the registers of each handler on its own instead of across the whole
+ * loop. The tail calls have to become jumps or the C stack would grow
+ * with every instruction: clang and gcc 15 guarantee it with musttail,
+ * older gcc versions do it anyway with -O2 and up.
+ */
 
-	TARGET_EQUAL: {
-		vm_exec_eq(vm);
-		DISPATCH();
-	}
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
 
-	TARGET_NOT_EQUAL: {
-		vm_exec_not_eq(vm);
-		DISPATCH();
-	}
+typedef int handler_fn(struct vm *vm, struct frame *frame, uint8_t *ip, struct object **sp, struct object **bp);
 
-	TARGET_GREATER_THAN: {
-		vm_exec_greater_than(vm);
-		DISPATCH();
-	}
+static handler_fn *const handlers[NUM_OPCODES];
 
-	TARGET_GREATER_THAN_EQUAL: {
-		vm_exec_greater_than_eq(vm);
-		DISPATCH();
-	}
+#define TARGET(name) static int handler_##name(struct vm *vm, struct frame *frame, uint8_t *ip, struct object **sp, struct object **bp)
+#define TARGET_ADDR(name) handler_##name
+#define DISPATCH() do { PROFILE_OP(*ip); MUSTTAIL return handlers[*ip](vm, frame, ip + 1, sp, bp); } while (0)
+#define consts (vm->state->consts)
+#define globals (vm->state->globals)
 
-	TARGET_MINUS: {
-		vm_exec_minus(vm);
-		DISPATCH();
-	}
+#include "targets.h"
 
-	TARGET_BANG: {
-		vm_exec_bang(vm);
-		DISPATCH();
-	}
+static handler_fn *const handlers[NUM_OPCODES] = {
+#include "jump_table.h"
+};
 
-	TARGET_INDEX: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#undef consts
+#undef globals
 
-	TARGET_CALL: {
-		uint8_t num_args = read_uint8(frame->ip++);
-		vm_exec_call(vm, num_args);
-		frame = vm_current_frame(vm);
-		DISPATCH();
-	}
+int vm_run(struct vm * restrict vm) {
+	struct frame *frame = vm_current_frame(vm);
+	uint8_t *ip;
+	struct object **sp;
+	struct object **bp;
+	LOAD_STATE();
+	PROFILE_ENTER();
+	PROFILE_OP(*ip);
+	return handlers[*ip](vm, frame, ip + 1, sp, bp);
+}
 
-	TARGET_CONCURRENT_CALL: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#else
 
-	TARGET_RETURN: {
-		vm_exec_return(vm);
-		frame = vm_current_frame(vm);
-		DISPATCH();
-	}
+#define TARGET(name) TARGET_##name:
+#define TARGET_ADDR(name) &&TARGET_##name
+#define DISPATCH() do { PROFILE_OP(*ip); goto *jump_table[*ip++]; } while (0)
 
-	TARGET_RETURN_VALUE: {
-		vm_exec_return_value(vm);
-		frame = vm_current_frame(vm);
-		DISPATCH();
-	}
+int vm_run(struct vm * restrict vm) {
+	static const void *jump_table[] = {
+#include "jump_table.h"
+	};
 
-	TARGET_JUMP: {
-		uint16_t pos = read_uint16(frame->ip);
-		frame->ip = &frame->start[pos];
-		DISPATCH();
-	}
+	register struct frame *frame = vm_current_frame(vm);
+	register uint8_t *ip;
+	register struct object **sp;
+	register struct object **bp;
+	struct object **consts = vm->state->consts;
+	struct object **globals = vm->state->globals;
+	LOAD_STATE();
+	PROFILE_ENTER();
+	DISPATCH();
 
-	TARGET_JUMP_NOT_TRUTHY: {
-		uint16_t pos = read_uint16(frame->ip);
-		frame->ip += 2;
+#include "targets.h"
+}
 
-		struct object *cond = unwrap(vm_stack_pop(vm));
-		if (!is_truthy(cond)) {
-			frame->ip = &frame->start[pos];
+#endif
+
+#undef PROFILE_ENTER
+#undef PROFILE_OP
+
+#undef TARGET
+#undef TARGET_ADDR
+#undef DISPATCH
+#undef OPERAND8
+#undef OPERAND16
+#undef JUMP
+#undef INSTR_OFFSET
+#undef SAVE_IP
+#undef LOAD_IP
+#undef LOAD_FRAME
+#undef LOOP_HEADER
+
+// Translates the function's bytecode to direct-threaded code using the
+// handler addresses of the table. The instructions that use an inline
+// cache get their bytecode offset as an extra operand.
+static union tcode *vm_thread_function(struct function *fn, const void **table) {
+	uint8_t *insts = fn->instructions;
+	size_t *index = malloc(sizeof(size_t) * (fn->len + 1));
+	size_t len = 0;
+
+	for (size_t i = 0; i < fn->len; i += instruction_len(insts[i])) {
+		index[i] = len;
+		len += 1 + definitions[insts[i]].noperands;
+		len += insts[i] == op_dot || insts[i] == op_define;
+	}
+
+	union tcode *code = malloc(sizeof(union tcode) * len);
+	union tcode *c = code;
+
+	for (size_t i = 0; i < fn->len; i += instruction_len(insts[i])) {
+		struct definition def = definitions[insts[i]];
+		size_t off = i + 1;
+
+		(c++)->handler = table[insts[i]];
+		for (int j = 0; j < def.noperands; j++) {
+			uintptr_t operand = def.opwidths[j] == 2 ? read_uint16(&insts[off]) : read_uint8(&insts[off]);
+			off += def.opwidths[j];
+
+			if (insts[i] == op_jump || insts[i] == op_jump_not_truthy) {
+				operand = (uintptr_t) &code[index[operand]];
+			}
+			(c++)->operand = operand;
+		}
+		if (insts[i] == op_dot || insts[i] == op_define) {
+			(c++)->operand = i;
 		}
-		DISPATCH();
-	}
-
-	TARGET_DOT: {
-		UNHANDLED();
-		DISPATCH();
-	}
-
-	TARGET_DEFINE: {
-		UNHANDLED();
-		DISPATCH();
-	}
-
-	TARGET_GET_GLOBAL: {
-		int global_idx = read_uint16(frame->ip);
-		frame->ip += 2;
-		vm_stack_push(vm, vm->state.globals[global_idx]);
-		DISPATCH();
-	}
-
-	TARGET_SET_GLOBAL: {
-		int global_idx = read_uint16(frame->ip);
-		frame->ip += 2;
-		vm->state.globals[global_idx] = vm_stack_peek(vm);
-		DISPATCH();
-	}
-
-	TARGET_GET_LOCAL: {
-		int local_idx = read_uint8(frame->ip++);
-		vm_stack_push(vm, vm->stack[frame->base_ptr+local_idx]);
-		DISPATCH();
-	}
-
-	TARGET_SET_LOCAL: {
-		int local_idx = read_uint8(frame->ip++);
-		vm->stack[frame->base_ptr+local_idx] = vm_stack_peek(vm);
-		DISPATCH();
-	}
-
-	TARGET_GET_BUILTIN: {
-		UNHANDLED();
-		DISPATCH();
-	}
-
-	TARGET_GET_FREE: {
-		int free_idx = read_uint8(frame->ip++);
-		struct object *cl = frame->cl;
-		vm_stack_push(vm, cl->data.cl->free[free_idx]);
-		DISPATCH();
 	}
 
-	TARGET_LOAD_MODULE: {
-		UNHANDLED();
-		DISPATCH();
-	}
+	free(index);
+	fn->threaded = code;
+	return code;
+}
 
-	TARGET_INTERPOLATE: {
-		UNHANDLED();
-		DISPATCH();
-	}
+#define TARGET(name) TARGET_##name:
+#define TARGET_ADDR(name) &&TARGET_##name
+#define DISPATCH() goto *(ip++)->handler
+#define OPERAND8() ((ip++)->operand)
+#define OPERAND16() ((ip++)->operand)
+#define JUMP(pos) ip = (union tcode *) (pos)
+#define INSTR_OFFSET() ((ip++)->operand)
+#define SAVE_IP() frame->tip = ip
+#define LOAD_IP() ip = frame->tip
+#define LOAD_FRAME() \
+	frame = vm_current_frame(vm); \
+	if (frame->tip == NULL) frame->tip = vm_thread_function(frame->cl->data.cl->fn, (const void **) jump_table); \
+	LOAD_STATE()
+#define LOOP_HEADER() (void) 0
+
+// Same as vm_run but executes direct-threaded code, which saves the
+// opcode and table loads and the operand decoding on every instruction.
+// Each function is translated the first time it's called.
+int vm_run_threaded(struct vm * restrict vm) {
+	static const void *jump_table[] = {
+#include "jump_table.h"
+	};
 
-	TARGET_POP: {
-		vm_stack_pop_ignore(vm);
-		DISPATCH();
-	}
+	register struct frame *frame = vm_current_frame(vm);
+	register union tcode *ip;
+	register struct object **sp;
+	register struct object **bp;
+	struct object **consts = vm->state->consts;
+	struct object **globals = vm->state->globals;
+	if (frame->tip == NULL) {
+		frame->tip = vm_thread_function(frame->cl->data.cl->fn, (const void **) jump_table);
+	}
+	LOAD_STATE();
+	DISPATCH();
 
-	TARGET_HALT:
-		return 0;
+#include "targets.h"
 }
@@ -4,38 +4,101 @@
 #include <stdint.h>
 #include "../obj/obj.h"
 #include "../compiler/compiler.h"
+#include "trace.h"
 
-#define STACK_SIZE 2048
-#define GLOBAL_SIZE 65536
-#define MAX_FRAMES 1024
+// The value stack and the frame stack start small and grow on demand up
+// to the maximum sizes, past which the VM exits with a stack overflow.
+#define STACK_MIN_SIZE 256
+#define STACK_MAX_SIZE (1 << 20)
+#define FRAMES_MIN_SIZE 32
+#define MAX_FRAMES (1 << 16)
+
+#define REGION_CHUNK_SIZE 256
+
+#define IC_SIZE 4
+
+// When next is not NULL the entry caches the transition caused by adding
+// the field to an object of the given shape.
+struct ic_entry {
+	struct shape *shape;
+	struct shape *next;
+	struct object *name; // op_define also stores with keys computed at runtime
+	uint32_t slot;
+};
+
+struct inline_cache {
+	struct ic_entry entries[IC_SIZE];
+	uint32_t nentries;
+	uint32_t megamorphic;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+// Bump allocator for the temporaries that the compiler proved don't
+// escape the frame evaluating them. Each frame records the length of the
+// region when it starts and the region is cut back to it on return.
+// The chunks are kept for reuse once allocated and never move.
+struct region {
+	struct object **chunks;
+	uint32_t nchunks;
+	uint32_t len;
+};
+
+// Direct-threaded code: each instruction is the address of its handler
+// followed by its operands decoded into whole words. Jump operands are
+// the addresses of their targets.
+union tcode {
+	const void *handler;
+	uintptr_t operand;
+};
 
 struct frame {
 	struct object *cl;
+	struct upvalue **free; // upvalues of the closure
+	union tcode *tip; // used instead of ip in direct-threaded mode
 	uint8_t *ip;
 	uint8_t *start;
 	uint32_t base_ptr;
+	uint32_t region_mark;
 };
 
+// What the VMs running the lines of the REPL share. The globals grow
+// with the symbols defined before each VM is made, so they don't move
+// while it runs.
 struct state {
 	struct symbol_table *st;
 	struct object **consts;
 	size_t nconsts;
-	struct object *globals[GLOBAL_SIZE];
+	struct object **globals;
+	size_t nglobals;
+	size_t globals_cap;
 };
 
 struct vm {
-	struct object *stack[STACK_SIZE];
-	struct frame frames[MAX_FRAMES];
-	struct state state;
+	struct object **stack;
+	struct frame *frames;
+	struct upvalue *open_upvalues; // sorted by decreasing slot
+	struct region region;
+	struct state *state;
+	struct state local_state; // of the VMs made without a state
 	uint32_t sp;
+	uint32_t stack_cap;
 	uint32_t frame_idx;
+	uint32_t frames_cap;
+	uint32_t jit_threshold; // calls before compiling a function, 0 disables the JIT
+	uint32_t trace_threshold; // loops before recording a trace, 0 disables tracing
+	uint32_t jit_depth; // native calls nested on the C stack
+	struct trace_stats trace_stats;
 };
 
 struct state new_state();
 struct vm *new_vm(struct bytecode bytecode);
-struct vm *new_vm_with_state(struct bytecode bytecode, struct state state);
+struct vm *new_vm_with_state(struct bytecode bytecode, struct state *state);
 int vm_run(struct vm * restrict vm);
+int vm_run_threaded(struct vm * restrict vm);
 struct object *vm_last_popped_stack_elem(struct vm * restrict vm);
 void vm_dispose(struct vm *vm);
+void vm_print_inline_caches(struct vm *vm);
+void vm_print_trace_stats(struct vm *vm);
 
 #endif
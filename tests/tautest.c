@@ -1,9 +1,14 @@
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "greatest.h"
 #include "../src/code/code.h"
 #include "../src/compiler/compiler.h"
 #include "../src/data/map.h"
+#include "../src/ir/ir.h"
+#include "../src/parser/parser.h"
+#include "../src/vm/vm.h"
 
 #define RESET_CODE(code) free(code); code = NULL
 
@@ -16,6 +21,32 @@ int compare(size_t n, uint8_t *b1, uint8_t *b2) {
 	return 1;
 }
 
+// Thresholds of the JIT and of the tracing in the VMs made by run,
+// 0 disables them.
+static uint32_t jit_threshold;
+static uint32_t trace_threshold;
+// Whether run compiles the functions through the SSA optimizer.
+static int optimize;
+
+// Compiles and runs the input returning the last popped object.
+struct object *run(char *input) {
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	c->optimize = optimize;
+	compile(c, tree);
+
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	vm->jit_threshold = jit_threshold;
+	vm->trace_threshold = trace_threshold;
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+
+	tree->dispose(tree);
+	compiler_dispose(c);
+	vm_dispose(vm);
+	return o;
+}
+
 TEST test_make(void) {
 	uint8_t *code = NULL;
 	uint8_t *expected = NULL;
@@ -121,10 +152,748 @@ TEST test_symboltable(void) {
 	PASS();
 }
 
+TEST test_map(void) {
+	struct object *m = new_map_obj(0);
+	struct object *k1 = new_string_obj("key", 3);
+	struct object *k2 = new_string_obj("key", 3);
+
+	for (int i = 0; i < 1000; i++) {
+		map_set(m->data.map, new_integer_obj(i), new_integer_obj(i * 2));
+	}
+	map_set(m->data.map, k1, true_obj);
+	ASSERT(m->data.map->len == 1001);
+	ASSERT(map_get(m->data.map, k2) == true_obj);
+	ASSERT(k2->hash != 0 && k1->hash == k2->hash);
+	ASSERT(map_get(m->data.map, new_integer_obj(999))->data.i == 1998);
+	ASSERT(map_get(m->data.map, new_integer_obj(1000)) == NULL);
+	ASSERT(map_get(m->data.map, new_float_obj(1)) == NULL);
+
+	// Insertion order is preserved.
+	ASSERT(m->data.map->entries[0].key->data.i == 0);
+	ASSERT(m->data.map->entries[1000].key == k1);
+
+	struct object *o = run("m = {\"a\": 1, 2: \"b\"}; m[\"c\"] = m[\"a\"] + 2; m[\"c\"]");
+	ASSERT(o->type == obj_integer && o->data.i == 3);
+
+	o = run("m = {1: 2}; m[3]");
+	ASSERT(o == null_obj);
+
+	PASS();
+}
+
+TEST test_class(void) {
+	struct object *a = new_class_obj();
+	struct object *b = new_class_obj();
+	struct object *x = new_string_obj("x", 1);
+	struct object *y = new_string_obj("y", 1);
+
+	for (int i = 0; i < 10; i++) {
+		char name[] = {'a' + i};
+		class_set(a, new_string_obj(name, 1), new_integer_obj(i));
+		class_set(b, new_string_obj(name, 1), new_integer_obj(i * 2));
+	}
+	// Same fields added in the same order share the shape.
+	ASSERT(a->data.inst->shape == b->data.inst->shape);
+	ASSERT(a->data.inst->shape->nfields == 10);
+	ASSERT(class_get(b, new_string_obj("j", 1))->data.i == 18);
+	ASSERT(class_get(a, x) == null_obj);
+
+	class_set(a, x, true_obj);
+	class_set(b, y, true_obj);
+	ASSERT(a->data.inst->shape != b->data.inst->shape);
+	ASSERT(a->data.inst->shape->parent == b->data.inst->shape->parent);
+
+	struct object *o = run(
+		"Dog = fn(name, age) { d = new(); d.name = name; d.age = age; d }\n"
+		"a = Dog(\"Snuffles\", 8); b = Dog(\"Rex\", 2)\n"
+		"a.age + b.age"
+	);
+	ASSERT(o->type == obj_integer && o->data.i == 10);
+
+	PASS();
+}
+
+TEST test_inline_cache(void) {
+	char *input =
+		"get = fn(o) { o.x }\n"
+		"a = new(); a.x = 1; get(a); get(a); get(a)\n"
+		"b = new(); b.y = 1; b.x = 2; get(b)\n"
+		"c = new(); c.z = 1; c.x = 3; get(c)\n"
+		"d = new(); d.w = 1; d.x = 4; get(d)\n"
+		"e = new(); e.v = 1; e.x = 5; get(e)\n"
+		"f = new(); f.u = 1; f.x = 6; get(f)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+	struct vm *vm = new_vm(bc);
+	vm_run(vm);
+	ASSERT(vm_last_popped_stack_elem(vm)->data.i == 6);
+
+	struct function *get = NULL;
+	for (int i = 0; i < bc.nconsts; i++) {
+		if (bc.consts[i]->type == obj_closure) {
+			get = bc.consts[i]->data.cl->fn;
+		}
+	}
+	ASSERT(get != NULL && get->caches != NULL);
+
+	struct inline_cache *ic = NULL;
+	for (int i = 0; i < get->len; i++) {
+		if (get->caches[i] != NULL) {
+			ASSERT(get->instructions[i] == op_dot);
+			ic = get->caches[i];
+		}
+	}
+	ASSERT(ic != NULL);
+	ASSERT(ic->hits == 2);
+	ASSERT(ic->misses == 6);
+	ASSERT(ic->nentries == IC_SIZE);
+	ASSERT(ic->megamorphic);
+
+	tree->dispose(tree);
+	compiler_dispose(c);
+	vm_dispose(vm);
+
+	// The same shape with another key doesn't hit a store's cache.
+	struct object *o = run("f = fn(o, k, v) { o[k] = v }; a = new(); f(a, \"x\", 1); b = new(); f(b, \"y\", 2); b.y");
+	ASSERT(o->type == obj_integer && o->data.i == 2);
+	PASS();
+}
+
+TEST test_string_concat(void) {
+	struct object *a = new_string_obj("hello", 5);
+	struct object *b = string_concat(a, new_string_obj(" ", 1));
+	struct object *c = string_concat(b, new_string_obj("world", 5));
+	struct object *d = string_concat(b, new_string_obj("there", 5));
+
+	ASSERT(c->len == 11 && memcmp(c->data.str, "hello world", 11) == 0);
+	ASSERT(d->len == 11 && memcmp(d->data.str, "hello there", 11) == 0);
+	ASSERT(a->len == 5 && memcmp(a->data.str, "hello", 5) == 0);
+	// c was appended in place to b's buffer while d had to copy it.
+	ASSERT(c->data.str == b->data.str);
+	ASSERT(d->data.str != b->data.str);
+	ASSERT(string_cmp(b, c) < 0 && string_cmp(c, d) > 0 && string_cmp(c, c) == 0);
+
+	struct object *o = run(
+		"build = fn(s, n) { if n > 0 { return build(s + \"ab\", n - 1) }; s }\n"
+		"build(\"\", 500)"
+	);
+	ASSERT(o->type == obj_string && o->len == 1000);
+	ASSERT(memcmp(o->data.str, "abab", 4) == 0);
+
+	PASS();
+}
+
+TEST test_interpolate(void) {
+	struct object *o = run(
+		"temp = 25\n"
+		"\"The temperature is { if temp > 20 { \\\"hot\\\" } else { \\\"cold\\\" } } ({temp - 30}) \\{x\\}\""
+	);
+	ASSERT(o->type == obj_string);
+	ASSERT_EQ(o->len, strlen("The temperature is hot (-5) {x}"));
+	ASSERT(memcmp(o->data.str, "The temperature is hot (-5) {x}", o->len) == 0);
+
+	char buf[FLOAT_BUF_SIZE];
+	char expected[FLOAT_BUF_SIZE];
+	double floats[] = {0, -0.0, 1.5, 0.0000005, 0.0000015, 0.1234565, 999999.9999995, -123.456, 1e300};
+	for (int i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+		size_t len = format_float(buf, floats[i]);
+		ASSERT_EQ(len, snprintf(expected, sizeof(expected), "%f", floats[i]));
+		ASSERT(memcmp(buf, expected, len) == 0);
+	}
+
+	int64_t ints[] = {0, 7, -10, INT64_MAX, INT64_MIN};
+	for (int i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+		size_t len = format_int(buf, ints[i]);
+		ASSERT_EQ(len, int_len(ints[i]));
+		ASSERT_EQ(len, snprintf(expected, sizeof(expected), "%lld", (long long) ints[i]));
+		ASSERT(memcmp(buf, expected, len) == 0);
+	}
+
+	PASS();
+}
+
+TEST test_builtins(void) {
+	char *input = "len([1, 2, 3])";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+
+	// The builtin is called by index without being pushed on the stack.
+	int idx = -1;
+	for (int i = 0; i < NUM_BUILTINS; i++) {
+		if (strcmp(builtins[i].name, "len") == 0) idx = i;
+	}
+	ASSERT(bc.insts[12] == op_call_builtin);
+	ASSERT(bc.insts[13] == idx && bc.insts[14] == 1);
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	struct object *o = run("len([1, 2, 3])");
+	ASSERT(o->type == obj_integer && o->data.i == 3);
+
+	o = run("l = append([1], 2, 3); a = append(l, 4); b = append(l, 5); a[3] + b[3] + len(l)");
+	ASSERT(o->type == obj_integer && o->data.i == 12);
+
+	// Storing in an appended list leaves the list it came from alone.
+	o = run("a = [1, 2]; b = append(a, 3); b[0] = 9; a[1] = 8; a[0] + a[1] + b[0] + b[1]");
+	ASSERT(o->type == obj_integer && o->data.i == 20);
+
+	o = run("f = len; f(\"abcd\") + int(\"10\")");
+	ASSERT(o->type == obj_integer && o->data.i == 14);
+
+	// A global can shadow a builtin.
+	o = run("len = 5; f = fn() { len + 1 }; len + f()");
+	ASSERT(o->type == obj_integer && o->data.i == 11);
+
+	o = run("string({\"a\": [1, \"b\"]})");
+	ASSERT(o->type == obj_string);
+	ASSERT(memcmp(o->data.str, "{\"a\": [1, \"b\"]}", o->len) == 0);
+
+	PASS();
+}
+
+TEST test_tail_call(void) {
+	// Far deeper than MAX_FRAMES, so it only works if the frame is reused.
+	struct object *o = run("loop = fn(n, acc) { if n > 0 { loop(n - 1, acc + n) } else { acc } }; loop(100000, 0)");
+	ASSERT(o->type == obj_integer && o->data.i == 5000050000);
+
+	o = run("f = fn(n) { if n > 0 { return f(n - 1) }; len(\"abc\") }; f(5000)");
+	ASSERT(o->type == obj_integer && o->data.i == 3);
+
+	// Calls whose result is used aren't tail calls.
+	o = run("f = fn(n) { if n > 0 { f(n - 1) + 1 } else { 0 } }; f(100)");
+	ASSERT(o->type == obj_integer && o->data.i == 100);
+
+	PASS();
+}
+
+TEST test_stack_growth(void) {
+	struct object *o = run("f = fn(n) { if n > 0 { f(n - 1) + 1 } else { 0 } }; f(20000)");
+	ASSERT(o->type == obj_integer && o->data.i == 20000);
+
+	PASS();
+}
+
+TEST test_stack_depth(void) {
+	char *input = "x = [1, 2, {\"a\": 3}]; if x { 1 } else { [4, 5] }";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+
+	// 1, 2, "a" and 3 are on the stack before the map is built.
+	ASSERT_EQ(4, bc.max_stack);
+
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	input = "f = fn(a, b, c) { [a, b, c] }";
+	tree = parse_input(input, strlen(input));
+	c = new_compiler();
+	compile(c, tree);
+	bc = compiler_bytecode(c);
+	struct object *fn = (*c->consts)[bc.nconsts-1];
+	ASSERT(fn->type == obj_closure);
+	ASSERT_EQ(3, fn->data.cl->fn->num_locals);
+	ASSERT_EQ(3, fn->data.cl->fn->max_stack);
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	PASS();
+}
+
+TEST test_closures(void) {
+	struct object *o = run("f = fn(a) { fn(b) { fn(c) { a + b + c + a } } }; f(1)(2)(3)");
+	ASSERT(o->type == obj_integer && o->data.i == 7);
+
+	// A variable captured more than once is stored only once.
+	char *input = "f = fn(a) { fn() { a + a } }";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+	struct function *inner = (*c->consts)[0]->data.fn;
+	ASSERT_EQ(op_closure, (*c->consts)[1]->data.cl->fn->instructions[0]);
+	ASSERT_EQ(1, inner->num_free);
+	ASSERT(inner->captures[0].local && inner->captures[0].index == 0);
+	ASSERT_EQ(2, bc.nconsts);
+
+	// The outer function doesn't capture anything so it's a constant.
+	ASSERT_EQ(op_constant, bc.insts[0]);
+	ASSERT_EQ(obj_closure, (*c->consts)[1]->type);
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	// Captured variables are shared with the enclosing function and
+	// between sibling closures, and survive the enclosing call.
+	o = run("f = fn() { x = 1; g = fn() { x }; x = 2; g() }; f()");
+	ASSERT(o->type == obj_integer && o->data.i == 2);
+
+	o = run("counter = fn() { n = 0; inc = fn() { n = n + 1 }; get = fn() { n }; [inc, get] };"
+		"c = counter(); c[0](); c[0](); c[1]()");
+	ASSERT(o->type == obj_integer && o->data.i == 2);
+
+	PASS();
+}
+
+TEST test_noescape(void) {
+	char *input = "f = fn(a, b, c) { if a + b > 0 { a + b + c - 1 } else { 0 } }; f(1, 2, 3) + f(4, 5, 6)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+
+	struct function *fn = NULL;
+	for (int i = 0; i < bc.nconsts; i++) {
+		if (bc.consts[i]->type == obj_closure) fn = bc.consts[i]->data.cl->fn;
+	}
+	ASSERT(fn != NULL);
+
+	int ntmp = 0, nheap = 0;
+	for (size_t i = 0; i < fn->len; i += instruction_len(fn->instructions[i])) {
+		switch (fn->instructions[i]) {
+		case op_add_tmp:
+		case op_sub_tmp:
+			ntmp++;
+			break;
+		case op_add:
+		case op_sub:
+			nheap++;
+			break;
+		}
+	}
+	// Only the returned difference escapes the frame.
+	ASSERT_EQ(3, ntmp);
+	ASSERT_EQ(1, nheap);
+
+	struct vm *vm = new_vm(bc);
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+	ASSERT(o->type == obj_integer && o->data.i == 19);
+	ASSERT_EQ(0, vm->region.len);
+	ASSERT(vm->region.nchunks > 0);
+
+	vm_dispose(vm);
+	tree->dispose(tree);
+	compiler_dispose(c);
+	PASS();
+}
+
+// Same as run but executes direct-threaded code.
+struct object *run_threaded(char *input) {
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	vm_run_threaded(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+
+	tree->dispose(tree);
+	compiler_dispose(c);
+	vm_dispose(vm);
+	return o;
+}
+
+TEST test_threaded(void) {
+	char *inputs[] = {
+		"fib = fn(n) { if n < 2 { n } else { fib(n - 1) + fib(n - 2) } }; fib(15)",
+		"loop = fn(n, acc) { if n > 0 { loop(n - 1, acc + n) } else { acc } }; loop(100000, 0)",
+		"counter = fn() { n = 0; inc = fn() { n = n + 1 }; [inc, fn() { n }] };"
+			"c = counter(); c[0](); c[0](); c[1]()",
+		"p = new(); p.x = 1; p.y = 2; f = fn(o) { o.x + o.y }; f(p) + f(p) + len([1, 2, 3])",
+	};
+
+	for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		struct object *a = run(inputs[i]);
+		struct object *b = run_threaded(inputs[i]);
+		ASSERT(a->type == obj_integer && b->type == obj_integer);
+		ASSERT_EQ(a->data.i, b->data.i);
+	}
+
+	PASS();
+}
+
+TEST test_jit(void) {
+	char *input = "fib = fn(n) { if n < 2 { n } else { fib(n - 1) + fib(n - 2) } }; fib(20)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+
+	struct vm *vm = new_vm(bc);
+	vm->jit_threshold = 10;
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+	ASSERT(o->type == obj_integer && o->data.i == 6765);
+
+	struct function *fib = NULL;
+	for (int i = 0; i < bc.nconsts; i++) {
+		if (bc.consts[i]->type == obj_closure) fib = bc.consts[i]->data.cl->fn;
+	}
+	ASSERT(fib != NULL);
+#if defined(__x86_64__) && defined(__linux__)
+	ASSERT(fib->jit != NULL);
+#endif
+	ASSERT_EQ(10, fib->calls);
+
+	vm_dispose(vm);
+	tree->dispose(tree);
+	compiler_dispose(c);
+	PASS();
+}
+
+TEST test_jit_deep_calls(void) {
+	// Deeper than JIT_MAX_DEPTH, so the innermost calls are left to the
+	// interpreter and the native code resumes as they return.
+	char *input = "sum = fn(n) { if n < 1 { 0 } else { n + sum(n - 1) } }; sum(3000)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	vm->jit_threshold = 1;
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+	ASSERT(o->type == obj_integer && o->data.i == 4501500);
+	ASSERT_EQ(0, vm->jit_depth);
+
+	vm_dispose(vm);
+	tree->dispose(tree);
+	compiler_dispose(c);
+	PASS();
+}
+
+TEST test_trace(void) {
+	// The trace is recorded while n > 5 and exits at the branch after.
+	char *input = "f = fn(n, acc) { if n > 5 { f(n - 1, acc + 2) } else { if n > 0 { f(n - 1, acc + 1) } else { acc } } }; f(20, 0)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	compile(c, tree);
+
+	struct vm *vm = new_vm(compiler_bytecode(c));
+	vm->trace_threshold = 3;
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+	ASSERT(o->type == obj_integer && o->data.i == 35);
+	ASSERT_EQ(1, vm->trace_stats.compiled);
+	ASSERT_EQ(0, vm->trace_stats.aborted);
+	// Once from the trace recorded for n > 5, then once per iteration.
+	ASSERT_EQ(vm->trace_stats.entered, vm->trace_stats.side_exits);
+	ASSERT_EQ(6, vm->trace_stats.side_exits);
+
+	vm_dispose(vm);
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	// The type guards fall back to the interpreter.
+	trace_threshold = 1;
+	o = run("f = fn(n, x, y) { if n > 0 { f(n - 1, x + y, y) } else { x } }; f(3, 0, 1) + len(f(3, \"a\", \"b\"))");
+	ASSERT(o->type == obj_integer && o->data.i == 7);
+	trace_threshold = 0;
+
+	PASS();
+}
+
+TEST test_ir(void) {
+	char *input = "f = fn(a, b) { x = a + b; if x > 3 { a + b - x + a } else { x } }; f(2, 3) + f(1, 1)";
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	c->optimize = 1;
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+
+	struct function *fn = NULL;
+	for (int i = 0; i < bc.nconsts; i++) {
+		if (bc.consts[i]->type == obj_closure) fn = bc.consts[i]->data.cl->fn;
+	}
+	ASSERT(fn != NULL);
+	// The second a + b is the value of x, which leaves x and the last sum.
+	int nadd = 0;
+	for (size_t i = 0; i < fn->len; i += instruction_len(fn->instructions[i])) {
+		nadd += fn->instructions[i] == op_add || fn->instructions[i] == op_add_tmp;
+	}
+	ASSERT_EQ(2, nadd);
+
+	struct vm *vm = new_vm(bc);
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+	ASSERT(o->type == obj_integer && o->data.i == 4);
+	vm_dispose(vm);
+	tree->dispose(tree);
+	compiler_dispose(c);
+
+	// The value of an if used more than once gets a local.
+	optimize = 1;
+	o = run("f = fn(a, b) { r = if a > b { a } else { b }; x = r + 1; x + r }; f(1, 5)");
+	ASSERT(o->type == obj_integer && o->data.i == 11);
+	o = run("f = fn(a, b) { r = if a > b { a } else { b }; r + if r > 3 { 1 } else { 0 } }; f(1, 5) + f(5, 1)");
+	ASSERT(o->type == obj_integer && o->data.i == 12);
+	optimize = 0;
+
+	// The compiler doesn't emit loops, so this one is made by hand:
+	// do { i = i - (a + a) } while (i > a + a); return i
+	uint8_t *code = NULL;
+	size_t len = make_bcode(&code, 0, op_null);
+	len = make_bcode(&code, len, op_pop);
+	size_t loop = len;
+	len = make_bcode(&code, len, op_get_local, 1);
+	len = make_bcode(&code, len, op_get_local, 0);
+	len = make_bcode(&code, len, op_get_local, 0);
+	len = make_bcode(&code, len, op_add);
+	len = make_bcode(&code, len, op_sub);
+	len = make_bcode(&code, len, op_set_local, 1);
+	len = make_bcode(&code, len, op_get_local, 0);
+	len = make_bcode(&code, len, op_get_local, 0);
+	len = make_bcode(&code, len, op_add);
+	len = make_bcode(&code, len, op_greater_than);
+	len = make_bcode(&code, len, op_jump_not_truthy, len + 6);
+	len = make_bcode(&code, len, op_jump, loop);
+	len = make_bcode(&code, len, op_get_local, 1);
+	len = make_bcode(&code, len, op_return_value);
+
+	struct ir_func *f = ir_build(code, len, 2, 2);
+	ASSERT(f != NULL);
+	ir_copy_propagate(f);
+	ir_cse(f);
+	ir_licm(f);
+	ir_dce(f);
+	ASSERT_EQ(1, f->ncse);
+	ASSERT_EQ(1, f->nhoisted);
+
+	int num_locals;
+	uint8_t *lowered = ir_lower(f, &len, &num_locals);
+	ASSERT(lowered != NULL);
+	// The sum is computed once before the loop.
+	size_t add = len, target = 0;
+	for (size_t i = 0; i < len; i += instruction_len(lowered[i])) {
+		if (lowered[i] == op_add) {
+			ASSERT_EQ(len, add);
+			add = i;
+		} else if (lowered[i] == op_jump) {
+			target = read_uint16(&lowered[i+1]);
+		}
+	}
+	ASSERT(add < target);
+
+	free(code);
+	free(lowered);
+	ir_dispose(f);
+	PASS();
+}
+
+// Compiles the input with the optimizer and returns the bytecode of the
+// last function compiled.
+static struct function *compile_optimized(char *input, size_t inline_threshold) {
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler();
+	c->optimize = 1;
+	c->inline_threshold = inline_threshold;
+	compile(c, tree);
+
+	struct function *fn = NULL;
+	for (int i = 0; i < c->nconsts; i++) {
+		struct object *o = (*c->consts)[i];
+		if (o->type == obj_closure) fn = o->data.cl->fn;
+	}
+	tree->dispose(tree);
+	compiler_dispose(c);
+	return fn;
+}
+
+static int count_ops(struct function *fn, enum opcode op) {
+	int n = 0;
+	for (size_t i = 0; i < fn->len; i += instruction_len(fn->instructions[i])) {
+		n += fn->instructions[i] == op;
+	}
+	return n;
+}
+
+TEST test_inline(void) {
+	char *input = "f = fn(a) { add = fn(x, y) { x + y }; add(a, 2) + add(3, a) }";
+	struct function *fn = compile_optimized(input, IR_INLINE_THRESHOLD);
+	ASSERT_EQ(0, count_ops(fn, op_call));
+	ASSERT_EQ(0, count_ops(fn, op_tail_call));
+
+	// The callee is larger than the threshold.
+	fn = compile_optimized(input, 4);
+	ASSERT_EQ(2, count_ops(fn, op_call));
+
+	// The inlined tail call returns the callee's values.
+	fn = compile_optimized("f = fn(a) { abs = fn(x) { if x > 0 { return x }; 0 - x }; abs(a) }", IR_INLINE_THRESHOLD);
+	ASSERT_EQ(0, count_ops(fn, op_tail_call));
+	ASSERT_EQ(2, count_ops(fn, op_return_value));
+
+	// The globals assigned once are folded, so the calls to them can be
+	// inlined, but not the ones assigned again.
+	fn = compile_optimized("sq = fn(x) { x + x }; n = 1; f = fn(a) { sq(a) + n }", IR_INLINE_THRESHOLD);
+	ASSERT_EQ(0, count_ops(fn, op_call));
+	ASSERT_EQ(0, count_ops(fn, op_get_global));
+	fn = compile_optimized("n = 1; f = fn(a) { n + a }; n = 2", IR_INLINE_THRESHOLD);
+	ASSERT_EQ(1, count_ops(fn, op_get_global));
+	// Nor the ones assigned in a branch that might not run.
+	fn = compile_optimized("c = 0; if c > 1 { n = 1 }; f = fn(a) { n + a }", IR_INLINE_THRESHOLD);
+	ASSERT_EQ(1, count_ops(fn, op_get_global));
+
+	// A function doesn't inline itself.
+	fn = compile_optimized("f = fn(n) { if n > 0 { f(n - 1) + 1 } else { 0 } }", IR_INLINE_THRESHOLD);
+	ASSERT(fn->len <= fn->orig_len);
+
+	optimize = 1;
+	struct object *o = run("f = fn(a) { add = fn(x, y) { x + y }; add(a, 2) + add(3, a) }; f(1)");
+	ASSERT(o->type == obj_integer && o->data.i == 7);
+	o = run("f = fn(a) { m = fn(x) { if len(x) > 0 { return x }; \"e\" }; m(a) + m(\"\") + m(a) }; f(\"z\")");
+	ASSERT(o->type == obj_string && o->len == 3 && memcmp(o->data.str, "zez", 3) == 0);
+	// The value merging the returns is used twice.
+	o = run("f = fn(a) { m = fn(x, y) { if x > y { return x }; y }; r = m(a, 3); r + 1 + r }; f(10) + f(0)");
+	ASSERT(o->type == obj_integer && o->data.i == 28);
+	optimize = 0;
+
+	PASS();
+}
+
+// Runs each line in its own VM sharing the state, like the REPL does.
+static struct object *run_with_state(struct state *state, char *input) {
+	struct node *tree = parse_input(input, strlen(input));
+	struct compiler *c = new_compiler_with_state(state->st, &state->consts, state->nconsts);
+	c->optimize = optimize;
+	compile(c, tree);
+	struct bytecode bc = compiler_bytecode(c);
+	state->nconsts = bc.nconsts;
+
+	struct vm *vm = new_vm_with_state(bc, state);
+	vm->jit_threshold = jit_threshold;
+	vm_run(vm);
+	struct object *o = vm_last_popped_stack_elem(vm);
+
+	tree->dispose(tree);
+	compiler_dispose(c);
+	vm_dispose(vm);
+	return o;
+}
+
+TEST test_globals(void) {
+	struct state state = new_state();
+
+	run_with_state(&state, "x = 5; f = fn(a) { a + x }");
+	struct object *o = run_with_state(&state, "y = f(x); y + x");
+	ASSERT(o->type == obj_integer && o->data.i == 15);
+
+	// The globals grow past their first allocation between the lines.
+	char input[2048] = "";
+	for (int i = 0; i < 100; i++) {
+		sprintf(&input[strlen(input)], "g%d = %d; ", i, i);
+	}
+	run_with_state(&state, input);
+	o = run_with_state(&state, "g0 + g99 + y");
+	ASSERT(o->type == obj_integer && o->data.i == 109);
+
+	// Assigning a global again undoes its folding in the earlier lines.
+	run_with_state(&state, "k = 1; h = fn() { k + 1 }");
+	run_with_state(&state, "k = 5");
+	o = run_with_state(&state, "h()");
+	ASSERT(o->type == obj_integer && o->data.i == 6);
+
+	free(state.globals);
+	PASS();
+}
+
+TEST test_output(void) {
+	int fds[2];
+	char buf[64];
+
+	ASSERT_EQ(0, pipe(fds));
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	int saved = dup(STDOUT_FILENO);
+	dup2(fds[1], STDOUT_FILENO);
+
+	// Output to a pipe stays buffered until it's flushed.
+	run("println(1, \"a\", [2, \"b\"]); print(3)");
+	ASSERT_EQ(-1, read(fds[0], buf, sizeof(buf)));
+	out_flush();
+
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	close(fds[1]);
+
+	ssize_t n = read(fds[0], buf, sizeof(buf));
+	close(fds[0]);
+	ASSERT_EQ(14, n);
+	ASSERT(memcmp(buf, "1 a [2, \"b\"]\n3", n) == 0);
+
+	PASS();
+}
+
 SUITE(tautest) {
 	RUN_TEST(test_make);
 	RUN_TEST(test_compiler);
 	RUN_TEST(test_symboltable);
+	RUN_TEST(test_map);
+	RUN_TEST(test_class);
+	RUN_TEST(test_inline_cache);
+	RUN_TEST(test_string_concat);
+	RUN_TEST(test_interpolate);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_tail_call);
+	RUN_TEST(test_stack_growth);
+	RUN_TEST(test_stack_depth);
+	RUN_TEST(test_closures);
+	RUN_TEST(test_noescape);
+	RUN_TEST(test_threaded);
+	RUN_TEST(test_jit);
+	RUN_TEST(test_jit_deep_calls);
+	RUN_TEST(test_trace);
+	RUN_TEST(test_ir);
+	RUN_TEST(test_inline);
+	RUN_TEST(test_globals);
+	RUN_TEST(test_output);
+}
+
+// The tests that run programs, with every function compiled by the JIT
+// on its first call.
+SUITE(jit) {
+	jit_threshold = 1;
+	RUN_TEST(test_class);
+	RUN_TEST(test_string_concat);
+	RUN_TEST(test_interpolate);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_tail_call);
+	RUN_TEST(test_stack_growth);
+	RUN_TEST(test_closures);
+	RUN_TEST(test_threaded);
+	RUN_TEST(test_globals);
+	jit_threshold = 0;
+}
+
+// The same tests with every loop traced after its first iteration.
+SUITE(trace) {
+	trace_threshold = 1;
+	RUN_TEST(test_class);
+	RUN_TEST(test_string_concat);
+	RUN_TEST(test_interpolate);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_tail_call);
+	RUN_TEST(test_stack_growth);
+	RUN_TEST(test_closures);
+	RUN_TEST(test_threaded);
+	trace_threshold = 0;
+}
+
+SUITE(opt) {
+	optimize = 1;
+	RUN_TEST(test_class);
+	RUN_TEST(test_string_concat);
+	RUN_TEST(test_interpolate);
+	RUN_TEST(test_builtins);
+	RUN_TEST(test_tail_call);
+	RUN_TEST(test_stack_growth);
+	RUN_TEST(test_closures);
+	RUN_TEST(test_threaded);
+	RUN_TEST(test_globals);
+	optimize = 0;
 }
 
 GREATEST_MAIN_DEFS();
@@ -132,5 +901,8 @@ GREATEST_MAIN_DEFS();
 int main(int argc, char **argv) {
 	GREATEST_MAIN_BEGIN();
 	RUN_SUITE(tautest);
+	RUN_SUITE(jit);
+	RUN_SUITE(trace);
+	RUN_SUITE(opt);
 	GREATEST_MAIN_END();
 }